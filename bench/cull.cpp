@@ -0,0 +1,51 @@
+// CPU only benchmark of the frustum culling path. `main --bench-cull` runs
+// the same scenes through both the CPU and the GPU path on a device
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "frustum.hpp"
+#include "stats.hpp"
+
+int main() {
+  const u32 ITERATIONS = 10;
+  std::mt19937 rng { 1234 };
+  std::uniform_real_distribution<f32> position(-500.0f, 500.0f);
+  std::uniform_real_distribution<f32> radius(0.5f, 4.0f);
+
+  auto frustum = Frustum::perspective(
+    { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f },
+    1.0f, 16.0f / 9.0f, 0.1f, 400.0f
+  );
+
+  std::cout
+    << std::setw(10) << "objects"
+    << std::setw(10) << "visible"
+    << std::setw(12) << "cull_ms"
+    << std::setw(14) << "ns_per_object" << std::endl;
+
+  for(u32 count : { 10'000u, 100'000u, 1'000'000u }) {
+    std::vector<Sphere> spheres(count);
+    for(auto& sphere : spheres) {
+      sphere = { { position(rng), position(rng), position(rng) }, radius(rng) };
+    }
+
+    std::vector<u32> visible;
+    visible.reserve(count);
+
+    f64 best = 1e9;
+    for(u32 i = 0; i < ITERATIONS; i++) {
+      Stopwatch watch;
+      cull(spheres, frustum, visible);
+      best = std::min(best, watch.elapsed_ms());
+    }
+
+    std::cout << std::fixed << std::setprecision(3)
+      << std::setw(10) << count
+      << std::setw(10) << visible.size()
+      << std::setw(12) << best
+      << std::setw(14) << best * 1e6 / count << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
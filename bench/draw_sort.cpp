@@ -0,0 +1,177 @@
+// CPU only benchmark of the draw list sort and merge, needs no device.
+// Also checks the mesh range allocator, both fail the run on a mismatch
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "draw_list.hpp"
+#include "range_allocator.hpp"
+#include "stats.hpp"
+
+struct Scene {
+  u32 passes = 2;
+  u32 pipelines = 32;
+  u32 materials = 512;
+  u32 meshes = 1000;
+};
+
+void fill(DrawList& list, u32 draws, const Scene& scene, std::mt19937& rng) {
+  std::uniform_int_distribution<u32> pass(0, scene.passes - 1);
+  std::uniform_int_distribution<u32> pipeline(0, scene.pipelines - 1);
+  std::uniform_int_distribution<u32> mesh(0, scene.meshes - 1);
+  std::uniform_real_distribution<f32> depth(0.1f, 1000.0f);
+
+  list.clear();
+  for(u32 i = 0; i < draws; i++) {
+    // Materials mostly stay with one mesh, as they would in a real scene
+    u32 m = mesh(rng);
+    u32 material = m % scene.materials;
+    u32 p = pass(rng);
+
+    list.push(
+      SortKey::make(p, pipeline(rng), material, SortKey::depth(depth(rng), p == 1)),
+      m, i
+    );
+  }
+}
+
+// Lowest offset with `size` free slots in a row, what first fit over
+// fully joined free ranges must return
+Option<u64> first_fit(const std::vector<bool>& used, u64 size) {
+  u64 run = 0;
+  for(u64 i = 0; i < used.size(); i++) {
+    run = used[i] ? 0 : run + 1;
+    if(run == size) return i + 1 - size;
+  }
+  return {};
+}
+
+bool check_ranges(std::mt19937& rng) {
+  const u64 CAPACITY = 4096;
+  RangeAllocator ranges { CAPACITY };
+
+  // Allocations split the front of the free range in order
+  if(ranges.allocate(100) != 0 || ranges.allocate(200) != 100
+  || ranges.allocate(300) != 300) {
+    std::cerr << "Range split mismatch" << std::endl;
+    return false;
+  }
+
+  // Freed neighbours join on both sides, the whole space comes back as one
+  ranges.free(0, 100);
+  ranges.free(300, 300);
+  ranges.free(100, 200);
+  if(ranges.used() != 0 || ranges.allocate(CAPACITY) != 0 || ranges.allocate(1)) {
+    std::cerr << "Range coalesce mismatch" << std::endl;
+    return false;
+  }
+  ranges.free(0, CAPACITY);
+
+  // Random allocations and frees against an occupancy map. Without joining
+  // the free ranges first fit would skip runs made of several pieces
+  std::vector<bool> used(CAPACITY, false);
+  std::vector<std::pair<u64, u64>> live;
+  u64 used_count = 0;
+  for(u32 i = 0; i < 20'000; i++) {
+    if(live.empty() || rng() % 2) {
+      u64 size = 1 + rng() % 64;
+      auto expected = first_fit(used, size);
+      auto offset = ranges.allocate(size);
+      if(offset != expected) {
+        std::cerr << "Range first fit mismatch at step " << i << std::endl;
+        return false;
+      }
+      if(!offset) continue;
+
+      std::fill(used.begin() + *offset, used.begin() + *offset + size, true);
+      live.push_back({ *offset, size });
+      used_count += size;
+    }
+    else {
+      size_t pick = rng() % live.size();
+      auto [offset, size] = live[pick];
+      live[pick] = live.back();
+      live.pop_back();
+
+      ranges.free(offset, size);
+      std::fill(used.begin() + offset, used.begin() + offset + size, false);
+      used_count -= size;
+    }
+
+    if(ranges.used() != used_count) {
+      std::cerr << "Range usage mismatch at step " << i << std::endl;
+      return false;
+    }
+  }
+
+  for(auto [offset, size] : live) ranges.free(offset, size);
+  if(ranges.allocate(CAPACITY) != 0) {
+    std::cerr << "Range space not recovered" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main() {
+  const u32 ITERATIONS = 10;
+  // What most desktop drivers report for maxDrawIndirectCount
+  const u32 MAX_MULTI_DRAW = ~0u;
+  Scene scene;
+  std::mt19937 rng { 1234 };
+  if(!check_ranges(rng)) return EXIT_FAILURE;
+
+  std::cout
+    << std::setw(10) << "draws"
+    << std::setw(10) << "batches"
+    << std::setw(10) << "runs"
+    << std::setw(10) << "changes"
+    << std::setw(10) << "calls"
+    << std::setw(12) << "calls_mdi"
+    << std::setw(12) << "radix_ms"
+    << std::setw(12) << "merge_ms"
+    << std::setw(14) << "std_sort_ms" << std::endl;
+
+  for(u32 draws : { 1'000u, 10'000u, 100'000u, 1'000'000u }) {
+    DrawList list;
+    Stats stats;
+    fill(list, draws, scene, rng);
+
+    // Best of several runs, the first one also pays for growing the arrays
+    f64 radix = 1e9, merge = 1e9, reference = 1e9;
+    for(u32 i = 0; i < ITERATIONS; i++) {
+      // The same path the renderer reports its draw.* stats through
+      list.build(stats, 1);
+      radix = std::min(radix, stats.get("draw.sort_ms"));
+      merge = std::min(merge, stats.get("draw.merge_ms"));
+
+      std::vector<std::pair<u64, u32>> pairs(draws);
+      for(u32 d = 0; d < draws; d++) pairs[d] = { list.keys[d], d };
+      Stopwatch watch;
+      std::stable_sort(pairs.begin(), pairs.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; }
+      );
+      reference = std::min(reference, watch.elapsed_ms());
+
+      for(u32 d = 0; d < draws; d++) {
+        if(pairs[d].second != list.order[d]) {
+          std::cerr << "Sort mismatch at " << d << std::endl;
+          return EXIT_FAILURE;
+        }
+      }
+    }
+
+    std::cout << std::fixed << std::setprecision(3)
+      << std::setw(10) << draws
+      << std::setw(10) << static_cast<u64>(stats.get("draw.batches"))
+      << std::setw(10) << list.runs.size()
+      << std::setw(10) << static_cast<u64>(stats.get("draw.state_changes"))
+      << std::setw(10) << static_cast<u64>(stats.get("draw.calls"))
+      << std::setw(12) << list.calls(MAX_MULTI_DRAW)
+      << std::setw(12) << radix
+      << std::setw(12) << merge
+      << std::setw(14) << reference << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
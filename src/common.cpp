@@ -1,5 +1,7 @@
 #include "common.hpp"
+#include "memory.hpp"
 #include <iostream>
+#include <stdexcept>
 
 
 std::strong_ordering operator<=>(const Version& lhs, const Version& rhs) {
@@ -44,7 +46,7 @@ DebugLog::~DebugLog()
   if(validation_enabled) {
     if(handle != VK_NULL_HANDLE) {  
       auto destroy = reinterpret_cast<PFN_vkDestroyDebugUtilsMessengerEXT>(
-        vkGetInstanceProcAddr(parent, "vkDestroyUtilsMessengerEXT")
+        vkGetInstanceProcAddr(parent, "vkDestroyDebugUtilsMessengerEXT")
       );
       destroy(parent, handle, nullptr);
     }
@@ -53,6 +55,7 @@ DebugLog::~DebugLog()
 DebugLog::DebugLog(DebugLog&& other) {
   handle = other.handle;
   parent = other.parent;
+  validation_enabled = other.validation_enabled;
 
   other.handle = VK_NULL_HANDLE;
   other.parent = VK_NULL_HANDLE;
@@ -85,16 +88,26 @@ std::vector<PhysicalDevice> Instance::devices() const {
 }
 
 
-PhysicalDevice::Features PhysicalDevice::features() {
+PhysicalDevice::Features PhysicalDevice::features() const {
   Features out;
   vkGetPhysicalDeviceFeatures(handle, &out);
   return out;
 }
-PhysicalDevice::Properties PhysicalDevice::properties() {
+PhysicalDevice::Properties PhysicalDevice::properties() const {
   Properties out;
   vkGetPhysicalDeviceProperties(handle, &out);
   return out;
 }
+PhysicalDevice::MemoryProperties PhysicalDevice::memory_properties() {
+  MemoryProperties out;
+  vkGetPhysicalDeviceMemoryProperties(handle, &out);
+  return out;
+}
+VkFormatProperties PhysicalDevice::format_properties(VkFormat format) {
+  VkFormatProperties out;
+  vkGetPhysicalDeviceFormatProperties(handle, format, &out);
+  return out;
+}
 std::vector<VkExtensionProperties> PhysicalDevice::extensions(const char* layer_name) {
   return checked_enumerate<VkExtensionProperties>(
     vkEnumerateDeviceExtensionProperties, handle, layer_name
@@ -128,13 +141,31 @@ std::vector<QueueFamily> PhysicalDevice::queue_families() {
 Device PhysicalDevice::create_device(VkDeviceCreateInfo& info) {
   VkDevice device;
   Error::check(vkCreateDevice(handle, &info, nullptr, &device));
-  return Device { device };
-}
 
-Device::Device(Handle handle): handle(handle) {
+  NameSet extensions { 
+    info.ppEnabledExtensionNames, 
+    info.ppEnabledExtensionNames + info.enabledExtensionCount 
+  };
+  PhysicalDevice::Features features {};
+  if(info.pEnabledFeatures) features = *info.pEnabledFeatures;
+
+  return Device { device, *this, std::move(extensions), features };
+}
 
+Device::Device(
+  Handle                   handle,
+  PhysicalDevice           physical,
+  NameSet                  extensions,
+  PhysicalDevice::Features features
+) : handle(handle), physical(physical), extensions(std::move(extensions)),
+  features(features) {
+  budget = std::make_shared<MemoryBudget>(
+    physical, has_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)
+  );
 }
-Device::Device(Device&& other) {
+Device::Device(Device&& other)
+: physical(other.physical), extensions(std::move(other.extensions)),
+  features(other.features), budget(std::move(other.budget)) {
   handle = other.handle;
   other.handle = VK_NULL_HANDLE;
 }
@@ -143,11 +174,53 @@ Device::~Device() {
 }
 
 Queue Device::get_queue(QueueFamily::Index family, u32 index) const {
-  Queue out;
+  Queue out { .family = family };
   vkGetDeviceQueue(handle, family, index, &out.handle);
   return out;
 }
 
+u32 Device::memory_type(u32 type_bits, VkMemoryPropertyFlags flags) const {
+  auto memory = PhysicalDevice { physical }.memory_properties();
+
+  for(u32 i = 0; i < memory.memoryTypeCount; i++) {
+    if((type_bits & (1u << i)) 
+    && (memory.memoryTypes[i].propertyFlags & flags) == flags) {
+      return i;
+    }
+  }
+  throw std::runtime_error("No suitable memory type");
+}
+
+VkDeviceMemory Device::allocate(
+  VkMemoryRequirements  requirements, 
+  VkMemoryPropertyFlags flags,
+  MemoryCategory        category
+) const {
+  VkMemoryAllocateInfo info {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = requirements.size,
+    .memoryTypeIndex = memory_type(requirements.memoryTypeBits, flags),
+  };
+
+  // The budget is advisory, the driver may still have room past it
+  budget->reserve(info.memoryTypeIndex, info.allocationSize);
+
+  VkDeviceMemory memory;
+  VkResult res = vkAllocateMemory(handle, &info, nullptr, &memory);
+  while(res == VK_ERROR_OUT_OF_DEVICE_MEMORY 
+  && budget->evict_one(budget->heap_of_type(info.memoryTypeIndex))) {
+    res = vkAllocateMemory(handle, &info, nullptr, &memory);
+  }
+  Error::check(res);
+
+  budget->track(memory, info.memoryTypeIndex, info.allocationSize, category);
+  return memory;
+}
+void Device::free(VkDeviceMemory memory) const {
+  budget->untrack(memory);
+  vkFreeMemory(handle, memory, nullptr);
+}
+
 
 
 Surface::Surface(Handle handle, VkInstance instance)
@@ -187,13 +260,33 @@ std::vector<Surface::PresentMode> Surface::get_present_modes(const PhysicalDevic
   );
 }
 
-bool Surface::compatible_with(const PhysicalDevice& device) {
+bool Surface::compatible_with(const PhysicalDevice& device) const {
   // VK_PRESENT_MODE_FIFO_KHR is required (from Vulkan 1.3 spec)
   // But I don't know if that assumes compatibility of the surface
 
+  // Frames are cleared with a transfer, only color attachment use is guaranteed
+  auto usage = get_limits(device).supportedUsageFlags;
+
   return !get_formats(device).empty() 
-      && !get_present_modes(device).empty();
+      && !get_present_modes(device).empty()
+      && (usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
 }
 
 void Surface::setup_swapchain(VkDevice device, VkSwapchainCreateInfoKHR config) {
 }
+
+
+
+Swapchain::Swapchain(const Device& device, const CreateInfo& info)
+: device(device), format(info.imageFormat), size(info.imageExtent) {
+  Error::check(vkCreateSwapchainKHR(device.handle, &info, nullptr, &handle));
+  images = checked_enumerate<VkImage>(
+    vkGetSwapchainImagesKHR, device.handle, handle
+  );
+}
+Swapchain::Swapchain(Swapchain&& other)
+: device(other.device), format(other.format), size(other.size), 
+  images(std::move(other.images)) {
+  handle = other.handle;
+  other.handle = VK_NULL_HANDLE;
+}
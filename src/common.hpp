@@ -3,8 +3,10 @@
 #include <vulkan/vk_enum_string_helper.h>
 
 #include "types.hpp"
+#include "nameset.hpp"
 
 #include <iostream>
+#include <memory>
 
 struct Error : std::exception {
   VkResult res;
@@ -122,6 +124,8 @@ struct QueueFamily;
 struct Device;
 struct Queue;
 
+class MemoryBudget;
+
 struct Surface;
 
 struct Instance {
@@ -158,9 +162,12 @@ struct PhysicalDevice {
 
   using Features = VkPhysicalDeviceFeatures;
   using Properties = VkPhysicalDeviceProperties;
+  using MemoryProperties = VkPhysicalDeviceMemoryProperties;
 
-  Features features();
-  Properties properties();
+  Features features() const;
+  Properties properties() const;
+  MemoryProperties memory_properties();
+  VkFormatProperties format_properties(VkFormat format);
 
   std::vector<VkExtensionProperties> extensions(const char* layer_name = nullptr);
   std::vector<QueueFamily> queue_families();
@@ -188,22 +195,61 @@ struct QueueFamily {
   }
 };
 
+enum class MemoryCategory : u32 {
+  Texture,
+  Buffer,
+  RenderTarget,
+  Staging,
+};
+constexpr u32 MEMORY_CATEGORY_COUNT = 4;
+
 struct Device {
   using Handle = VkDevice;
   Handle handle;
-
-  Device(Handle handle);
+  PhysicalDevice physical;
+  NameSet extensions;
+  PhysicalDevice::Features features;
+
+  // Every allocation goes through here so eviction can run before one fails
+  std::shared_ptr<MemoryBudget> budget;
+
+  Device(
+    Handle                   handle,
+    PhysicalDevice           physical,
+    NameSet                  extensions,
+    PhysicalDevice::Features features = {}
+  );
   ~Device();
 
   Device(Device&& other);
   Device& operator=(Device&& other) = default;
  
   Queue get_queue(QueueFamily::Index family, u32 index) const;
+
+  bool has_extension(const char* name) const {
+    return extensions.find(name);
+  }
+
+  template<typename PFN>
+  PFN proc(const char* name) const {
+    return reinterpret_cast<PFN>(vkGetDeviceProcAddr(handle, name));
+  }
+
+  /// Index of a memory type allowed by `type_bits` with all of `flags` set
+  u32 memory_type(u32 type_bits, VkMemoryPropertyFlags flags) const;
+
+  VkDeviceMemory allocate(
+    VkMemoryRequirements  requirements, 
+    VkMemoryPropertyFlags flags,
+    MemoryCategory        category
+  ) const;
+  void free(VkDeviceMemory memory) const;
 };
 
 struct Queue {
   using Handle = VkQueue;
   Handle handle;
+  QueueFamily::Index family;
 };
 
 struct Surface {
@@ -225,7 +271,7 @@ struct Surface {
   std::vector<Format> get_formats(const PhysicalDevice& device) const;
   std::vector<PresentMode> get_present_modes(const PhysicalDevice& device) const;
 
-  bool compatible_with(const PhysicalDevice& device);
+  bool compatible_with(const PhysicalDevice& device) const;
   void setup_swapchain(VkDevice device, VkSwapchainCreateInfoKHR config);
 };
 
@@ -242,7 +288,17 @@ struct Swapchain {
   Handle handle;
   const Device& device;
 
+  VkFormat format;
+  VkExtent2D size;
+  std::vector<VkImage> images;
+
+  Swapchain(const Device& device, const CreateInfo& info);
   ~Swapchain() { 
-    vkDestroySwapchainKHR(device.handle, handle, nullptr); 
+    if(handle != VK_NULL_HANDLE) {
+      vkDestroySwapchainKHR(device.handle, handle, nullptr); 
+    }
   } 
+
+  // Move only - cannot be copied
+  Swapchain(Swapchain&& other);
 };
\ No newline at end of file
@@ -0,0 +1,287 @@
+#include "cull.hpp"
+#include <cstring>
+#include <stdexcept>
+
+// SPIR-V words of shaders/cull.comp, generated by glslc at build time
+static const u32 CULL_SHADER[] =
+#include "cull.comp.inc"
+;
+
+struct CullConstants {
+  std::array<Plane, 6> planes;
+  u32 object_count;
+};
+
+static_assert(sizeof(Sphere) == 16 && sizeof(Plane) == 16);
+static_assert(sizeof(GpuCuller::Object) == 32);
+static_assert(sizeof(CullConstants) <= 128, "Past the guaranteed push constant size");
+
+constexpr u32 CULL_GROUP_SIZE = 64;
+
+
+
+GpuCuller::GpuCuller(const Device& device, Queue queue, u32 capacity)
+: m_device(device), m_queue(queue), m_capacity(capacity),
+  m_objects(device,
+    VkDeviceSize { capacity } * sizeof(Object),
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  ),
+  m_commands(device,
+    VkDeviceSize { capacity } * sizeof(VkDrawIndexedIndirectCommand),
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+  ),
+  m_count(device,
+    sizeof(u32),
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+      | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+      | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  ),
+  m_pool(device, queue.family), m_cmd(m_pool.allocate()),
+  m_fence(device, true)
+{
+  PhysicalDevice physical { device.physical };
+  if(!physical.queue_families()[queue.family].has_compute()) {
+    throw std::runtime_error("GPU culling needs a compute queue");
+  }
+
+  std::array<VkDescriptorSetLayoutBinding, 3> bindings;
+  for(u32 i = 0; i < bindings.size(); i++) {
+    bindings[i] = VkDescriptorSetLayoutBinding {
+      .binding = i,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    };
+  }
+  VkDescriptorSetLayoutCreateInfo set_layout_info {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = static_cast<u32>(bindings.size()),
+    .pBindings = bindings.data(),
+  };
+  Error::check(vkCreateDescriptorSetLayout(
+    device.handle, &set_layout_info, nullptr, &m_set_layout
+  ));
+
+  VkDescriptorPoolSize pool_size {
+    .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    .descriptorCount = static_cast<u32>(bindings.size()),
+  };
+  VkDescriptorPoolCreateInfo pool_info {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+    .maxSets = 1,
+    .poolSizeCount = 1,
+    .pPoolSizes = &pool_size,
+  };
+  Error::check(vkCreateDescriptorPool(
+    device.handle, &pool_info, nullptr, &m_descriptor_pool
+  ));
+
+  VkDescriptorSetAllocateInfo set_info {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+    .descriptorPool = m_descriptor_pool,
+    .descriptorSetCount = 1,
+    .pSetLayouts = &m_set_layout,
+  };
+  Error::check(vkAllocateDescriptorSets(device.handle, &set_info, &m_set));
+
+  // Buffers never change, the set is written once
+  std::array<VkDescriptorBufferInfo, 3> buffers {
+    VkDescriptorBufferInfo { m_objects.handle,  0, VK_WHOLE_SIZE },
+    VkDescriptorBufferInfo { m_commands.handle, 0, VK_WHOLE_SIZE },
+    VkDescriptorBufferInfo { m_count.handle,    0, VK_WHOLE_SIZE },
+  };
+  std::array<VkWriteDescriptorSet, 3> writes;
+  for(u32 i = 0; i < writes.size(); i++) {
+    writes[i] = VkWriteDescriptorSet {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = m_set,
+      .dstBinding = i,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pBufferInfo = &buffers[i],
+    };
+  }
+  vkUpdateDescriptorSets(device.handle, static_cast<u32>(writes.size()), writes.data(), 0, nullptr);
+
+  VkPushConstantRange constants {
+    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    .offset = 0,
+    .size = sizeof(CullConstants),
+  };
+  VkPipelineLayoutCreateInfo layout_info {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &m_set_layout,
+    .pushConstantRangeCount = 1,
+    .pPushConstantRanges = &constants,
+  };
+  Error::check(vkCreatePipelineLayout(device.handle, &layout_info, nullptr, &m_layout));
+
+  VkShaderModuleCreateInfo module_info {
+    .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+    .codeSize = sizeof(CULL_SHADER),
+    .pCode = CULL_SHADER,
+  };
+  VkShaderModule module;
+  Error::check(vkCreateShaderModule(device.handle, &module_info, nullptr, &module));
+
+  VkComputePipelineCreateInfo pipeline_info {
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+      .module = module,
+      .pName = "main",
+    },
+    .layout = m_layout,
+  };
+  VkResult res = vkCreateComputePipelines(
+    device.handle, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &m_pipeline
+  );
+  vkDestroyShaderModule(device.handle, module, nullptr);
+  Error::check(res);
+
+  auto family = physical.queue_families()[queue.family];
+  if(family.handle.timestampValidBits > 0) {
+    VkQueryPoolCreateInfo query_info {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = 2,
+    };
+    Error::check(vkCreateQueryPool(device.handle, &query_info, nullptr, &m_queries));
+    m_timestamp_period = physical.properties().limits.timestampPeriod;
+  }
+}
+
+GpuCuller::~GpuCuller() {
+  m_fence.wait();
+  if(m_queries != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(m_device.handle, m_queries, nullptr);
+  }
+  vkDestroyPipeline(m_device.handle, m_pipeline, nullptr);
+  vkDestroyPipelineLayout(m_device.handle, m_layout, nullptr);
+  vkDestroyDescriptorPool(m_device.handle, m_descriptor_pool, nullptr);
+  vkDestroyDescriptorSetLayout(m_device.handle, m_set_layout, nullptr);
+}
+
+void GpuCuller::set_objects(std::span<const Object> objects) {
+  if(objects.size() > m_capacity) {
+    throw std::runtime_error("More objects than the culler was created for");
+  }
+  m_fence.wait();
+
+  std::memcpy(m_objects.mapped, objects.data(), objects.size_bytes());
+  m_object_count = static_cast<u32>(objects.size());
+}
+
+void GpuCuller::report(Stats& stats) {
+  if(!m_pending) return;
+  m_pending = false;
+
+  stats.set("cull.gpu_tested", m_object_count);
+  stats.set("cull.gpu_visible", *static_cast<const u32*>(m_count.mapped));
+
+  if(m_queries != VK_NULL_HANDLE) {
+    std::array<u64, 2> ticks;
+    Error::check(vkGetQueryPoolResults(
+      m_device.handle, m_queries, 0, 2, sizeof(ticks), ticks.data(),
+      sizeof(u64), VK_QUERY_RESULT_64_BIT
+    ));
+    stats.set("cull.gpu_ms", (ticks[1] - ticks[0]) * m_timestamp_period * 1e-6);
+  }
+}
+
+void GpuCuller::finish(Stats& stats) {
+  m_fence.wait();
+  report(stats);
+}
+
+void GpuCuller::cull(const Frustum& frustum, Stats& stats) {
+  m_fence.wait();
+  report(stats);
+
+  Stopwatch record;
+  VkCommandBufferBeginInfo begin {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  Error::check(vkResetCommandBuffer(m_cmd, 0));
+  Error::check(vkBeginCommandBuffer(m_cmd, &begin));
+
+  if(m_queries != VK_NULL_HANDLE) {
+    vkCmdResetQueryPool(m_cmd, m_queries, 0, 2);
+    vkCmdWriteTimestamp(m_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queries, 0);
+  }
+
+  // Draws of the previous frame may still read the commands and count
+  VkMemoryBarrier reuse {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(m_cmd,
+    VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+    0, 1, &reuse, 0, nullptr, 0, nullptr
+  );
+  vkCmdFillBuffer(m_cmd, m_count.handle, 0, sizeof(u32), 0);
+
+  VkMemoryBarrier cleared {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(m_cmd,
+    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    0, 1, &cleared, 0, nullptr, 0, nullptr
+  );
+
+  CullConstants constants {
+    .planes = frustum.planes,
+    .object_count = m_object_count,
+  };
+  vkCmdBindPipeline(m_cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+  vkCmdBindDescriptorSets(m_cmd,
+    VK_PIPELINE_BIND_POINT_COMPUTE, m_layout, 0, 1, &m_set, 0, nullptr
+  );
+  vkCmdPushConstants(m_cmd,
+    m_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants
+  );
+  vkCmdDispatch(m_cmd, (m_object_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+  // Covers draws in later submissions too, they come after in submission order
+  VkMemoryBarrier culled {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT,
+  };
+  vkCmdPipelineBarrier(m_cmd,
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+    0, 1, &culled, 0, nullptr, 0, nullptr
+  );
+
+  if(m_queries != VK_NULL_HANDLE) {
+    vkCmdWriteTimestamp(m_cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queries, 1);
+  }
+  Error::check(vkEndCommandBuffer(m_cmd));
+
+  VkSubmitInfo submit {
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &m_cmd,
+  };
+  m_fence.reset();
+  Error::check(vkQueueSubmit(m_queue.handle, 1, &submit, m_fence.handle));
+  m_pending = true;
+
+  stats.set("cull.record_ms", record.elapsed_ms());
+}
+
+void GpuCuller::record_draw(VkCommandBuffer cmd) const {
+  vkCmdDrawIndexedIndirectCount(cmd,
+    m_commands.handle, 0, m_count.handle, 0,
+    m_object_count, sizeof(VkDrawIndexedIndirectCommand)
+  );
+}
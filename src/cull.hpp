@@ -0,0 +1,70 @@
+#pragma once
+#include <span>
+
+#include "common.hpp"
+#include "frustum.hpp"
+#include "resource.hpp"
+#include "stats.hpp"
+
+/// Frustum culls objects in a compute pass and compacts the survivors into
+/// indirect draws, drawn with one vkCmdDrawIndexedIndirectCount.
+///
+/// Needs a queue with compute, multiDrawIndirect, drawIndirectFirstInstance
+/// and the Vulkan 1.2 drawIndirectCount feature. Each surviving draw has its
+/// object id as first instance
+class GpuCuller {
+public:
+  /// Same layout as `Object` in shaders/cull.comp
+  struct Object {
+    Sphere bounds;
+    u32 index_count;
+    u32 first_index;
+    i32 vertex_offset;
+    u32 id;
+  };
+
+  GpuCuller(const Device& device, Queue queue, u32 capacity);
+  ~GpuCuller();
+
+  GpuCuller(GpuCuller&&) = delete;
+
+  /// Replaces the culled objects, waits for the cull in flight
+  void set_objects(std::span<const Object> objects);
+
+  /// Reports the previous cull, then submits a new one against `frustum`
+  void cull(const Frustum& frustum, Stats& stats);
+  /// Waits for the cull in flight and reports it now instead of on the next `cull`
+  void finish(Stats& stats);
+
+  /// Draws the survivors of the last cull, geometry must already be bound.
+  /// Submit after `cull` on the same queue
+  void record_draw(VkCommandBuffer cmd) const;
+
+private:
+  const Device& m_device;
+  Queue m_queue;
+  u32 m_capacity;
+  u32 m_object_count = 0;
+
+  Buffer m_objects;
+  Buffer m_commands;
+  // Host visible so the visible count can be read back once the fence signals
+  Buffer m_count;
+
+  VkDescriptorSetLayout m_set_layout = VK_NULL_HANDLE;
+  VkDescriptorPool m_descriptor_pool = VK_NULL_HANDLE;
+  VkDescriptorSet m_set = VK_NULL_HANDLE;
+  VkPipelineLayout m_layout = VK_NULL_HANDLE;
+  VkPipeline m_pipeline = VK_NULL_HANDLE;
+
+  // Start and end of the cull pass, absent if the queue has no timestamps
+  VkQueryPool m_queries = VK_NULL_HANDLE;
+  f64 m_timestamp_period = 0.0;
+
+  CommandPool m_pool;
+  VkCommandBuffer m_cmd;
+  Fence m_fence;
+  bool m_pending = false;
+
+  void report(Stats& stats);
+};
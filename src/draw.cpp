@@ -0,0 +1,231 @@
+#include "draw.hpp"
+#include <cstring>
+#include <stdexcept>
+
+
+
+MeshBuffers::MeshBuffers(const Device& device, Config config)
+: m_device(device), m_config(config),
+  m_vertices(device,
+    VkDeviceSize { config.vertex_capacity } * config.vertex_stride,
+    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+  ),
+  m_indices(device,
+    VkDeviceSize { config.index_capacity } * sizeof(u32),
+    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+  ),
+  m_vertex_ranges(config.vertex_capacity),
+  m_index_ranges(config.index_capacity),
+  m_staging(device,
+    config.staging_size,
+    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    MemoryCategory::Staging
+  ) {}
+
+Option<MeshBuffers::Id> MeshBuffers::add(
+  std::span<const u8>  vertices,
+  std::span<const u32> indices
+) {
+  // A partial vertex would spill into the next mesh, an empty copy is invalid
+  if(vertices.empty() || indices.empty()
+  || vertices.size() % m_config.vertex_stride != 0) {
+    throw std::runtime_error("Mesh needs whole vertices and at least one index");
+  }
+  u32 vertex_count = static_cast<u32>(vertices.size() / m_config.vertex_stride);
+  u32 index_count = static_cast<u32>(indices.size());
+
+  // Keep index data 4 byte aligned for the copy
+  VkDeviceSize vertex_bytes = (vertices.size_bytes() + 3) & ~VkDeviceSize { 3 };
+  if(m_staging_offset + vertex_bytes + indices.size_bytes() > m_staging.size) return {};
+
+  auto first_vertex = m_vertex_ranges.allocate(vertex_count);
+  if(!first_vertex) return {};
+  auto first_index = m_index_ranges.allocate(index_count);
+  if(!first_index) {
+    m_vertex_ranges.free(*first_vertex, vertex_count);
+    return {};
+  }
+
+  auto staging = static_cast<u8*>(m_staging.mapped);
+  std::memcpy(staging + m_staging_offset, vertices.data(), vertices.size_bytes());
+  m_vertex_copies.push_back(VkBufferCopy {
+    .srcOffset = m_staging_offset,
+    .dstOffset = *first_vertex * m_config.vertex_stride,
+    .size = vertices.size_bytes(),
+  });
+  m_staging_offset += vertex_bytes;
+
+  std::memcpy(staging + m_staging_offset, indices.data(), indices.size_bytes());
+  m_index_copies.push_back(VkBufferCopy {
+    .srcOffset = m_staging_offset,
+    .dstOffset = *first_index * sizeof(u32),
+    .size = indices.size_bytes(),
+  });
+  m_staging_offset += indices.size_bytes();
+
+  Mesh mesh {
+    .vertex_offset = static_cast<i32>(*first_vertex),
+    .vertex_count = vertex_count,
+    .first_index = static_cast<u32>(*first_index),
+    .index_count = index_count,
+  };
+
+  if(!m_free_ids.empty()) {
+    Id id = m_free_ids.back();
+    m_free_ids.pop_back();
+    m_meshes[id] = mesh;
+    return id;
+  }
+  m_meshes.push_back(mesh);
+  return static_cast<Id>(m_meshes.size() - 1);
+}
+
+void MeshBuffers::remove(Id id) {
+  auto& mesh = *m_meshes[id];
+  m_vertex_ranges.free(static_cast<u64>(mesh.vertex_offset), mesh.vertex_count);
+  m_index_ranges.free(mesh.first_index, mesh.index_count);
+
+  m_meshes[id].reset();
+  m_free_ids.push_back(id);
+}
+
+void MeshBuffers::flush(VkCommandBuffer cmd) {
+  if(!m_vertex_copies.empty()) {
+    vkCmdCopyBuffer(cmd, m_staging.handle, m_vertices.handle,
+      static_cast<u32>(m_vertex_copies.size()), m_vertex_copies.data()
+    );
+    vkCmdCopyBuffer(cmd, m_staging.handle, m_indices.handle,
+      static_cast<u32>(m_index_copies.size()), m_index_copies.data()
+    );
+
+    VkMemoryBarrier barrier {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+      0, 1, &barrier, 0, nullptr, 0, nullptr
+    );
+  }
+
+  m_vertex_copies.clear();
+  m_index_copies.clear();
+  m_staging_offset = 0;
+}
+
+void MeshBuffers::bind(VkCommandBuffer cmd) const {
+  VkDeviceSize offset = 0;
+  vkCmdBindVertexBuffers(cmd, 0, 1, &m_vertices.handle, &offset);
+  vkCmdBindIndexBuffer(cmd, m_indices.handle, 0, VK_INDEX_TYPE_UINT32);
+}
+
+
+
+DrawSubmitter::DrawSubmitter(const Device& device, const MeshBuffers& meshes)
+: m_device(device), m_meshes(meshes) {
+  m_multi_draw = device.features.multiDrawIndirect
+    && device.features.drawIndirectFirstInstance;
+  m_max_multi_draw = m_multi_draw
+    ? device.physical.properties().limits.maxDrawIndirectCount
+    : 1;
+
+  // Never left empty, the object buffer can be bound before the first draw
+  const u32 initial_draws = 1024;
+  reserve(m_commands,
+    initial_draws * sizeof(VkDrawIndexedIndirectCommand),
+    VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+  );
+  reserve(m_objects, initial_draws * sizeof(u32), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+}
+
+void DrawSubmitter::reserve(
+  Buffer&            buffer,
+  VkDeviceSize       size,
+  VkBufferUsageFlags usage
+) {
+  if(buffer.size >= size) return;
+
+  // Grow geometrically so a growing scene does not reallocate every frame
+  VkDeviceSize grown = std::max(size, buffer.size * 2);
+  buffer = Buffer {};
+  buffer = Buffer { m_device,
+    grown,
+    usage,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  };
+}
+
+void DrawSubmitter::prepare(Stats& stats) {
+  m_list.build(stats, m_max_multi_draw);
+
+  reserve(m_commands,
+    m_list.batches.size() * sizeof(VkDrawIndexedIndirectCommand),
+    VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+  );
+  reserve(m_objects,
+    m_list.sorted_objects.size() * sizeof(u32),
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+  );
+
+  auto commands = static_cast<VkDrawIndexedIndirectCommand*>(m_commands.mapped);
+  for(size_t i = 0; i < m_list.batches.size(); i++) {
+    auto& batch = m_list.batches[i];
+    auto& mesh = m_meshes.get(batch.mesh);
+    commands[i] = VkDrawIndexedIndirectCommand {
+      .indexCount = mesh.index_count,
+      .instanceCount = batch.count,
+      .firstIndex = mesh.first_index,
+      .vertexOffset = mesh.vertex_offset,
+      .firstInstance = batch.first,
+    };
+  }
+  std::memcpy(m_objects.mapped,
+    m_list.sorted_objects.data(), m_list.sorted_objects.size() * sizeof(u32)
+  );
+}
+
+void DrawSubmitter::record(
+  VkCommandBuffer cmd,
+  const Binder&   binder
+) const {
+  if(m_list.runs.empty()) return;
+  m_meshes.bind(cmd);
+
+  u64 prev = ~(m_list.runs[0].state << SortKey::DEPTH_BITS);
+  auto commands = static_cast<const VkDrawIndexedIndirectCommand*>(m_commands.mapped);
+
+  for(auto& run : m_list.runs) {
+    u64 key = run.state << SortKey::DEPTH_BITS;
+
+    bool new_pass = SortKey::pass(key) != SortKey::pass(prev);
+    bool new_pipeline = new_pass || SortKey::pipeline(key) != SortKey::pipeline(prev);
+    if(new_pass) binder.pass(cmd, SortKey::pass(key));
+    if(new_pipeline) binder.pipeline(cmd, SortKey::pipeline(key));
+    if(new_pipeline || SortKey::material(key) != SortKey::material(prev)) {
+      binder.material(cmd, SortKey::material(key));
+    }
+    prev = key;
+
+    if(m_multi_draw) {
+      for(u32 done = 0; done < run.batch_count; done += m_max_multi_draw) {
+        u32 count = std::min(run.batch_count - done, m_max_multi_draw);
+        vkCmdDrawIndexedIndirect(cmd, m_commands.handle,
+          (run.first_batch + done) * sizeof(VkDrawIndexedIndirectCommand),
+          count, sizeof(VkDrawIndexedIndirectCommand)
+        );
+      }
+      continue;
+    }
+
+    for(u32 i = run.first_batch; i < run.first_batch + run.batch_count; i++) {
+      auto& draw = commands[i];
+      vkCmdDrawIndexed(cmd, draw.indexCount, draw.instanceCount,
+        draw.firstIndex, draw.vertexOffset, draw.firstInstance
+      );
+    }
+  }
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <span>
+#include <vector>
+
+#include "common.hpp"
+#include "draw_list.hpp"
+#include "range_allocator.hpp"
+#include "resource.hpp"
+#include "stats.hpp"
+
+/// Where a mesh lives in the shared buffers, indices are relative to `vertex_offset`
+struct Mesh {
+  i32 vertex_offset;
+  u32 vertex_count;
+  u32 first_index;
+  u32 index_count;
+};
+
+/// Shared vertex and index buffers every mesh is sub-allocated from.
+///
+/// Geometry is bound once per command buffer, so draws of different meshes
+/// never need a rebind and can be merged into one multi-draw
+class MeshBuffers {
+public:
+  using Id = u32;
+
+  struct Config {
+    u32 vertex_stride = 32;
+    u32 vertex_capacity = 1 << 20;
+    u32 index_capacity = 4 << 20;
+    /// Upload bytes between two flushes
+    VkDeviceSize staging_size = VkDeviceSize { 8 } << 20;
+  };
+
+  MeshBuffers(const Device& device, Config config);
+
+  MeshBuffers(MeshBuffers&&) = delete;
+
+  /// Nothing if the buffers are full or staging is, the latter clears on `flush`.
+  /// Both spans must be non empty and `vertices` whole vertices
+  Option<Id> add(std::span<const u8> vertices, std::span<const u32> indices);
+  void remove(Id id);
+
+  const Mesh& get(Id id) const {
+    return *m_meshes[id];
+  }
+
+  /// Records the copies of every mesh added since the last flush.
+  /// Staging is reused right after, the previous flush must have completed
+  void flush(VkCommandBuffer cmd);
+
+  void bind(VkCommandBuffer cmd) const;
+
+private:
+  const Device& m_device;
+  Config m_config;
+
+  Buffer m_vertices;
+  Buffer m_indices;
+  RangeAllocator m_vertex_ranges;
+  RangeAllocator m_index_ranges;
+
+  Buffer m_staging;
+  VkDeviceSize m_staging_offset = 0;
+  std::vector<VkBufferCopy> m_vertex_copies;
+  std::vector<VkBufferCopy> m_index_copies;
+
+  std::vector<Option<Mesh>> m_meshes;
+  std::vector<Id> m_free_ids;
+};
+
+/// Sorts a frame's draws and records them with as few calls and binds as it can.
+///
+/// Draws in a batch are instances of one mesh, and every batch of a state run
+/// goes out as one vkCmdDrawIndexedIndirect when multiDrawIndirect is enabled.
+/// Shaders find their object with `objects()[gl_InstanceIndex]`
+class DrawSubmitter {
+public:
+  /// Called whenever the sorted list reaches a new pass, pipeline or material
+  struct Binder {
+    std::function<void(VkCommandBuffer, u32 pass)> pass;
+    std::function<void(VkCommandBuffer, u32 pipeline)> pipeline;
+    std::function<void(VkCommandBuffer, u32 material)> material;
+  };
+
+  DrawSubmitter(const Device& device, const MeshBuffers& meshes);
+
+  DrawSubmitter(DrawSubmitter&&) = delete;
+
+  DrawList& list() {
+    return m_list;
+  }
+
+  /// Sorts, merges and writes the draw commands of this frame's list.
+  /// Buffers are rewritten in place, the previous frame must have completed
+  void prepare(Stats& stats);
+
+  void record(VkCommandBuffer cmd, const Binder& binder) const;
+
+  /// Object index per instance, in sorted order
+  const Buffer& objects() const {
+    return m_objects;
+  }
+
+private:
+  const Device& m_device;
+  const MeshBuffers& m_meshes;
+  bool m_multi_draw;
+  u32 m_max_multi_draw;
+
+  DrawList m_list;
+  Buffer m_commands;
+  Buffer m_objects;
+
+  // Grows `buffer` to hold at least `size` bytes
+  void reserve(Buffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage);
+};
@@ -0,0 +1,114 @@
+#include "draw_list.hpp"
+#include <array>
+#include <numeric>
+#include <utility>
+
+
+
+void DrawList::sort() {
+  u32 count = size();
+  sorted_keys.assign(keys.begin(), keys.end());
+  order.resize(count);
+  std::iota(order.begin(), order.end(), 0u);
+  if(count == 0) return;
+
+  scratch_keys.resize(count);
+  scratch_order.resize(count);
+
+  // Histograms for every byte in a single read of the keys
+  std::array<std::array<u32, 256>, 8> histograms {};
+  for(auto key : keys) {
+    for(u32 byte = 0; byte < 8; byte++) {
+      histograms[byte][(key >> (byte * 8)) & 0xFF]++;
+    }
+  }
+
+  for(u32 byte = 0; byte < 8; byte++) {
+    u32 shift = byte * 8;
+    auto& offsets = histograms[byte];
+
+    // Every key shares this byte, the pass would not move anything.
+    // Usually true for the pass and pipeline bits
+    if(offsets[(sorted_keys[0] >> shift) & 0xFF] == count) continue;
+
+    u32 total = 0;
+    for(auto& offset : offsets) {
+      total += std::exchange(offset, total);
+    }
+
+    for(u32 i = 0; i < count; i++) {
+      u64 key = sorted_keys[i];
+      u32 slot = offsets[(key >> shift) & 0xFF]++;
+      scratch_keys[slot] = key;
+      scratch_order[slot] = order[i];
+    }
+    std::swap(sorted_keys, scratch_keys);
+    std::swap(order, scratch_order);
+  }
+}
+
+void DrawList::merge() {
+  u32 count = size();
+  sorted_objects.resize(count);
+  batches.clear();
+  runs.clear();
+
+  for(u32 i = 0; i < count; i++) {
+    u32 draw = order[i];
+    u32 mesh = meshes[draw];
+    u64 state = SortKey::state(sorted_keys[i]);
+    sorted_objects[i] = objects[draw];
+
+    if(runs.empty() || runs.back().state != state) {
+      runs.push_back(StateRun {
+        .state = state,
+        .first_batch = static_cast<u32>(batches.size()),
+        .batch_count = 0,
+      });
+    }
+
+    // Same mesh right after, draw one more instance instead
+    auto& run = runs.back();
+    if(run.batch_count > 0 && batches.back().mesh == mesh) {
+      batches.back().count++;
+      continue;
+    }
+    batches.push_back(DrawBatch { .mesh = mesh, .first = i, .count = 1 });
+    run.batch_count++;
+  }
+}
+
+u32 DrawList::calls(u32 max_multi_draw) const {
+  u32 calls = 0;
+  for(auto& run : runs) {
+    // Runs are never empty, and drivers often report a limit of UINT32_MAX
+    calls += (run.batch_count - 1) / max_multi_draw + 1;
+  }
+  return calls;
+}
+
+void DrawList::build(Stats& stats, u32 max_multi_draw) {
+  timed(stats, "draw.sort_ms", [&] { sort(); });
+  timed(stats, "draw.merge_ms", [&] { merge(); });
+
+  stats.set("draw.count", size());
+  stats.set("draw.batches", static_cast<f64>(batches.size()));
+  stats.set("draw.calls", calls(max_multi_draw));
+  stats.set("draw.state_changes", state_changes());
+}
+
+u32 DrawList::state_changes() const {
+  u32 changes = 0;
+  for(size_t i = 0; i < runs.size(); i++) {
+    u64 key = runs[i].state << SortKey::DEPTH_BITS;
+    u64 prev = i > 0 ? runs[i - 1].state << SortKey::DEPTH_BITS : ~key;
+
+    // A new pipeline may have a different layout, materials are bound again
+    bool new_pipeline
+      =  SortKey::pass(key) != SortKey::pass(prev)
+      || SortKey::pipeline(key) != SortKey::pipeline(prev);
+    if(new_pipeline) changes++;
+    if(new_pipeline || SortKey::material(key) != SortKey::material(prev)) changes++;
+  }
+  return changes;
+}
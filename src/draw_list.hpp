@@ -0,0 +1,117 @@
+#pragma once
+#include <bit>
+#include <vector>
+
+#include "stats.hpp"
+#include "types.hpp"
+
+/// A draw's state packed into 64 bits, sorting the keys groups draws that
+/// share state. Most significant first:
+///
+///   pass (4) | pipeline (12) | material (16) | depth (32)
+namespace SortKey {
+  constexpr u32 PASS_BITS     = 4;
+  constexpr u32 PIPELINE_BITS = 12;
+  constexpr u32 MATERIAL_BITS = 16;
+  constexpr u32 DEPTH_BITS    = 32;
+
+  constexpr u32 MATERIAL_SHIFT = DEPTH_BITS;
+  constexpr u32 PIPELINE_SHIFT = MATERIAL_SHIFT + MATERIAL_BITS;
+  constexpr u32 PASS_SHIFT     = PIPELINE_SHIFT + PIPELINE_BITS;
+
+  constexpr u64 mask(u32 bits) {
+    return (u64 { 1 } << bits) - 1;
+  }
+
+  /// View depth as an order preserving integer, `back_to_front` for blended passes
+  constexpr u32 depth(f32 view_depth, bool back_to_front = false) {
+    // Non negative floats order the same as their bit patterns, also catches NaN
+    u32 bits = std::bit_cast<u32>(view_depth > 0.0f ? view_depth : 0.0f);
+    return back_to_front ? ~bits : bits;
+  }
+
+  constexpr u64 make(u32 pass, u32 pipeline, u32 material, u32 depth) {
+    return (u64 { pass }     & mask(PASS_BITS))     << PASS_SHIFT
+         | (u64 { pipeline } & mask(PIPELINE_BITS)) << PIPELINE_SHIFT
+         | (u64 { material } & mask(MATERIAL_BITS)) << MATERIAL_SHIFT
+         | (u64 { depth }    & mask(DEPTH_BITS));
+  }
+
+  constexpr u32 pass(u64 key) {
+    return static_cast<u32>((key >> PASS_SHIFT) & mask(PASS_BITS));
+  }
+  constexpr u32 pipeline(u64 key) {
+    return static_cast<u32>((key >> PIPELINE_SHIFT) & mask(PIPELINE_BITS));
+  }
+  constexpr u32 material(u64 key) {
+    return static_cast<u32>((key >> MATERIAL_SHIFT) & mask(MATERIAL_BITS));
+  }
+  /// Everything but depth, draws with equal state can share one call
+  constexpr u64 state(u64 key) {
+    return key >> DEPTH_BITS;
+  }
+}
+
+/// `count` instances of `mesh`, instance `i` draws the object at
+/// `DrawList::sorted_objects[first + i]`
+struct DrawBatch {
+  u32 mesh;
+  u32 first;
+  u32 count;
+};
+
+/// Consecutive batches that share every piece of bound state,
+/// recorded as one multi-draw when the device allows it
+struct StateRun {
+  u64 state;
+  u32 first_batch;
+  u32 batch_count;
+};
+
+/// Draws submitted for one frame as parallel arrays, sorting only moves keys
+/// and indices around instead of whole draw records
+struct DrawList {
+  std::vector<u64> keys;
+  std::vector<u32> meshes;
+  std::vector<u32> objects;
+
+  // Filled by sort()
+  std::vector<u64> sorted_keys;
+  std::vector<u32> order;
+
+  // Filled by merge()
+  std::vector<u32> sorted_objects;
+  std::vector<DrawBatch> batches;
+  std::vector<StateRun> runs;
+
+  std::vector<u64> scratch_keys;
+  std::vector<u32> scratch_order;
+
+  void clear() {
+    keys.clear();
+    meshes.clear();
+    objects.clear();
+  }
+  void push(u64 key, u32 mesh, u32 object) {
+    keys.push_back(key);
+    meshes.push_back(mesh);
+    objects.push_back(object);
+  }
+  u32 size() const {
+    return static_cast<u32>(keys.size());
+  }
+
+  /// Stable LSD radix sort of the draws by key, 8 bits per pass
+  void sort();
+  /// Groups the sorted draws into instanced batches and state runs
+  void merge();
+
+  /// Pipeline and material binds needed to record the runs in order
+  u32 state_changes() const;
+  /// Draw calls needed when one call covers up to `max_multi_draw` batches,
+  /// 1 without multi-draw
+  u32 calls(u32 max_multi_draw) const;
+
+  /// Sorts and merges, then reports `draw.*` stats. Needs no device
+  void build(Stats& stats, u32 max_multi_draw);
+};
@@ -0,0 +1,146 @@
+#include "frame_allocator.hpp"
+#include <cstring>
+#include <stdexcept>
+
+
+
+FrameAllocator::FrameAllocator(const Device& device, Config config)
+: m_device(device), m_config(config) {
+  auto limits = device.physical.properties().limits;
+
+  // Region sizes are multiples of the alignment, so every offset handed out is aligned
+  m_alignment = limits.minUniformBufferOffsetAlignment;
+  m_config.frame_size = (config.frame_size + m_alignment - 1) / m_alignment * m_alignment;
+  m_config.binding_range = std::min(config.binding_range, limits.maxUniformBufferRange);
+  // Push constant ranges and updates are made of whole 4 byte words
+  m_push_size = std::min(config.push_size, limits.maxPushConstantsSize) & ~3u;
+
+  // The tail lets a binding at the very end of the last region stay in bounds
+  VkDeviceSize size = m_config.frames * m_config.frame_size + m_config.binding_range;
+  if(size > UINT32_MAX) {
+    throw std::runtime_error("Frame allocator regions past dynamic offset range");
+  }
+  m_buffer = Buffer { device,
+    size,
+    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  };
+
+  VkDescriptorSetLayoutBinding binding {
+    .binding = 0,
+    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+    .descriptorCount = 1,
+    .stageFlags = m_config.stages,
+  };
+  VkDescriptorSetLayoutCreateInfo set_layout_info {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = 1,
+    .pBindings = &binding,
+  };
+  Error::check(vkCreateDescriptorSetLayout(
+    device.handle, &set_layout_info, nullptr, &m_set_layout
+  ));
+
+  VkDescriptorPoolSize pool_size {
+    .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+    .descriptorCount = 1,
+  };
+  VkDescriptorPoolCreateInfo pool_info {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+    .maxSets = 1,
+    .poolSizeCount = 1,
+    .pPoolSizes = &pool_size,
+  };
+  Error::check(vkCreateDescriptorPool(
+    device.handle, &pool_info, nullptr, &m_descriptor_pool
+  ));
+
+  VkDescriptorSetAllocateInfo set_info {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+    .descriptorPool = m_descriptor_pool,
+    .descriptorSetCount = 1,
+    .pSetLayouts = &m_set_layout,
+  };
+  Error::check(vkAllocateDescriptorSets(device.handle, &set_info, &m_set));
+
+  // Written once, allocations only move the dynamic offset
+  VkDescriptorBufferInfo buffer_info { m_buffer.handle, 0, m_config.binding_range };
+  VkWriteDescriptorSet write {
+    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+    .dstSet = m_set,
+    .dstBinding = 0,
+    .descriptorCount = 1,
+    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+    .pBufferInfo = &buffer_info,
+  };
+  vkUpdateDescriptorSets(device.handle, 1, &write, 0, nullptr);
+}
+
+FrameAllocator::~FrameAllocator() {
+  vkDestroyDescriptorPool(m_device.handle, m_descriptor_pool, nullptr);
+  vkDestroyDescriptorSetLayout(m_device.handle, m_set_layout, nullptr);
+}
+
+void FrameAllocator::begin_frame(u64 frame) {
+  m_region = (frame % m_config.frames) * m_config.frame_size;
+  m_offset = 0;
+  m_requested = 0;
+  m_pushed = 0;
+  m_overflows = 0;
+}
+
+Option<u32> FrameAllocator::allocate(u32 size) {
+  if(size > m_config.binding_range) {
+    throw std::runtime_error("Frame allocation larger than the binding range");
+  }
+  VkDeviceSize aligned = (size + m_alignment - 1) / m_alignment * m_alignment;
+
+  u64 offset = m_offset.fetch_add(aligned, std::memory_order_relaxed);
+  if(offset + aligned > m_config.frame_size) {
+    m_overflows.fetch_add(1, std::memory_order_relaxed);
+    return {};
+  }
+  m_requested.fetch_add(size, std::memory_order_relaxed);
+  return static_cast<u32>(m_region + offset);
+}
+
+bool FrameAllocator::upload(
+  VkCommandBuffer     cmd,
+  VkPipelineBindPoint bind_point,
+  VkPipelineLayout    layout,
+  u32                 set,
+  std::span<const u8> data
+) {
+  u32 size = static_cast<u32>(data.size());
+  u32 words = (size + 3) & ~3u;
+  if(words <= m_push_size) {
+    // Pushes must be whole words, a partial last word goes out zero padded
+    u32 whole = size & ~3u;
+    if(whole > 0) {
+      vkCmdPushConstants(cmd, layout, m_config.stages, 0, whole, data.data());
+    }
+    if(whole < size) {
+      u32 tail = 0;
+      std::memcpy(&tail, data.data() + whole, size - whole);
+      vkCmdPushConstants(cmd, layout, m_config.stages, whole, sizeof(tail), &tail);
+    }
+    m_pushed.fetch_add(words, std::memory_order_relaxed);
+    return true;
+  }
+
+  auto offset = allocate(size);
+  if(!offset) return false;
+
+  std::memcpy(mapped(*offset), data.data(), size);
+  vkCmdBindDescriptorSets(cmd, bind_point, layout, set, 1, &m_set, 1, &*offset);
+  return true;
+}
+
+void FrameAllocator::report(Stats& stats) const {
+  u64 used = std::min<u64>(m_offset.load(), m_config.frame_size);
+
+  stats.set("frame_alloc.bytes", static_cast<f64>(m_requested.load()));
+  stats.set("frame_alloc.used_bytes", static_cast<f64>(used));
+  stats.set("frame_alloc.push_bytes", static_cast<f64>(m_pushed.load()));
+  stats.set("frame_alloc.overflows", m_overflows.load());
+}
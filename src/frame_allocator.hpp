@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <span>
+
+#include "common.hpp"
+#include "resource.hpp"
+#include "stats.hpp"
+
+/// Per-frame constants (transforms, material parameters) bump allocated from
+/// one persistently mapped uniform buffer, with a region per frame in flight.
+///
+/// Every allocation is reached through the same long-lived descriptor set
+/// with a dynamic offset, so nothing is created or updated per frame.
+/// Payloads up to `push_limit()` bytes go to push constants instead, shaders
+/// pick the block by payload size the same way
+class FrameAllocator {
+public:
+  struct Config {
+    u32 frames = 2;
+    /// Bytes each frame may allocate
+    VkDeviceSize frame_size = VkDeviceSize { 4 } << 20;
+    /// Largest payload, and how much of the buffer a binding can see
+    u32 binding_range = 16 << 10;
+    /// Push constant bytes used for small payloads, clamped to the device limit
+    u32 push_size = 128;
+    VkShaderStageFlags stages = VK_SHADER_STAGE_ALL;
+  };
+
+  FrameAllocator(const Device& device, Config config);
+  ~FrameAllocator();
+
+  FrameAllocator(FrameAllocator&&) = delete;
+
+  /// Moves to the region of `frame`, whose previous use must have completed
+  void begin_frame(u64 frame);
+
+  /// Reserves `size` bytes in this frame's region and returns the dynamic
+  /// offset, nothing when the region is full. Safe from several threads
+  Option<u32> allocate(u32 size);
+  void* mapped(u32 offset) const {
+    return static_cast<u8*>(m_buffer.mapped) + offset;
+  }
+
+  /// Makes `data` visible to the shaders of `layout`, through push constants
+  /// when it is small enough and through the descriptor set at index `set`
+  /// otherwise. False if the frame's region overflowed. Safe from several threads
+  bool upload(
+    VkCommandBuffer     cmd,
+    VkPipelineBindPoint bind_point,
+    VkPipelineLayout    layout,
+    u32                 set,
+    std::span<const u8> data
+  );
+  template<typename T>
+  bool upload(
+    VkCommandBuffer     cmd,
+    VkPipelineBindPoint bind_point,
+    VkPipelineLayout    layout,
+    u32                 set,
+    const T&            value
+  ) {
+    return upload(cmd, bind_point, layout, set,
+      std::span { reinterpret_cast<const u8*>(&value), sizeof(T) }
+    );
+  }
+
+  /// For pipeline layouts that use the allocator
+  VkDescriptorSetLayout set_layout() const {
+    return m_set_layout;
+  }
+  VkPushConstantRange push_range() const {
+    return { m_config.stages, 0, m_push_size };
+  }
+  u32 push_limit() const {
+    return m_push_size;
+  }
+
+  void report(Stats& stats) const;
+
+private:
+  const Device& m_device;
+  Config m_config;
+  VkDeviceSize m_alignment;
+  u32 m_push_size;
+
+  Buffer m_buffer;
+  VkDeviceSize m_region = 0;
+
+  VkDescriptorSetLayout m_set_layout = VK_NULL_HANDLE;
+  VkDescriptorPool m_descriptor_pool = VK_NULL_HANDLE;
+  VkDescriptorSet m_set = VK_NULL_HANDLE;
+
+  // Bump pointer into the current region, may run past the end on overflow
+  std::atomic<u64> m_offset = 0;
+  std::atomic<u64> m_requested = 0;
+  std::atomic<u64> m_pushed = 0;
+  std::atomic<u32> m_overflows = 0;
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <span>
+#include <vector>
+
+#include "types.hpp"
+
+struct Vec3 {
+  f32 x = 0, y = 0, z = 0;
+
+  friend Vec3 operator+(Vec3 a, Vec3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+  friend Vec3 operator-(Vec3 a, Vec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+  friend Vec3 operator*(Vec3 a, f32 s)  { return { a.x * s, a.y * s, a.z * s }; }
+
+  static f32 dot(Vec3 a, Vec3 b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+  }
+  static Vec3 cross(Vec3 a, Vec3 b) {
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+  }
+  static Vec3 normalize(Vec3 v) {
+    return v * (1.0f / std::sqrt(dot(v, v)));
+  }
+};
+
+/// Laid out as one vec4, shaders read it straight from a storage buffer
+struct Sphere {
+  Vec3 center;
+  f32 radius;
+};
+
+/// Points with `dot(normal, p) + d >= 0` are on the inner side
+struct Plane {
+  Vec3 normal;
+  f32 d;
+
+  static Plane through(Vec3 normal, Vec3 point) {
+    normal = Vec3::normalize(normal);
+    return { normal, -Vec3::dot(normal, point) };
+  }
+  f32 distance(Vec3 point) const {
+    return Vec3::dot(normal, point) + d;
+  }
+};
+
+struct Frustum {
+  std::array<Plane, 6> planes;
+
+  /// `fov_y` in radians, `forward` and `up` need not be orthogonal
+  static Frustum perspective(
+    Vec3 position, Vec3 forward, Vec3 up,
+    f32 fov_y, f32 aspect, f32 z_near, f32 z_far
+  ) {
+    Vec3 f = Vec3::normalize(forward);
+    Vec3 r = Vec3::normalize(Vec3::cross(f, up));
+    Vec3 u = Vec3::cross(r, f);
+
+    f32 tan_y = std::tan(fov_y * 0.5f);
+    f32 tan_x = tan_y * aspect;
+
+    // Side normals are the edge directions rotated a quarter turn inwards
+    return { {
+      Plane::through(f,               position + f * z_near),
+      Plane::through(f * -1.0f,       position + f * z_far),
+      Plane::through(f * tan_x + r,   position),
+      Plane::through(f * tan_x - r,   position),
+      Plane::through(f * tan_y + u,   position),
+      Plane::through(f * tan_y - u,   position),
+    } };
+  }
+
+  bool visible(const Sphere& sphere) const {
+    for(const auto& plane : planes) {
+      if(plane.distance(sphere.center) < -sphere.radius) return false;
+    }
+    return true;
+  }
+};
+
+/// CPU culling path, replaces `visible` with the indices of spheres in the frustum
+inline void cull(
+  std::span<const Sphere> spheres,
+  const Frustum&          frustum,
+  std::vector<u32>&       visible
+) {
+  visible.clear();
+  for(u32 i = 0; i < spheres.size(); i++) {
+    if(frustum.visible(spheres[i])) visible.push_back(i);
+  }
+}
@@ -1,11 +1,23 @@
+#include <iomanip>
 #include <iostream>
+#include <random>
+#include <sstream>
 #include <string>
+#include <string_view>
 
 #include <algorithm>
+#include <exception>
 
 #include "types.hpp"
 #include "nameset.hpp"
 #include "common.hpp"
+#include "cull.hpp"
+#include "frame_allocator.hpp"
+#include "stats.hpp"
+#include "memory.hpp"
+#include "present.hpp"
+#include "texture.hpp"
+#include "thread_pool.hpp"
 
 #include <GLFW/glfw3.h>
 
@@ -28,48 +40,167 @@ struct Adapter {
   PhysicalDevice physical_device;
   QueueFamily family;
   NameSet extensions;
+  PhysicalDevice::Features features {};
+  bool host_image_copy = false;
+  bool gpu_culling = false;
+
+  static bool supports_host_image_copy(PhysicalDevice device, std::ostream& log) {
+    NameSet required = {
+      VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME,
+      VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME,
+      VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME,
+    };
+    if(!required.supported(device.extensions(), log)) return false;
 
-  static Adapter from(const Instance& instance, const Surface& surface) {
-    constexpr auto score = [](PhysicalDevice device) {
-      auto prop = device.properties();
-      return (prop.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ? 10 : 1);
+    VkPhysicalDeviceHostImageCopyFeaturesEXT host_image_copy {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT,
     };
-    constexpr auto compare_device = [](PhysicalDevice left, PhysicalDevice right) {
-      return score(left) > score(right);
+    VkPhysicalDeviceFeatures2 features {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &host_image_copy,
     };
+    vkGetPhysicalDeviceFeatures2(device.handle, &features);
+    return host_image_copy.hostImageCopy;
+  }
 
-    auto devices = instance.devices();
-    std::sort(devices.begin(), devices.end(), compare_device);
+  static bool supports_gpu_culling(
+    PhysicalDevice                  device,
+    QueueFamily                     family,
+    const PhysicalDevice::Features& enabled
+  ) {
+    if(!family.has_compute()
+    || !enabled.multiDrawIndirect
+    || device.properties().apiVersion < VK_API_VERSION_1_2) return false;
+
+    VkPhysicalDeviceVulkan12Features vulkan12 {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    };
+    VkPhysicalDeviceFeatures2 features {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &vulkan12,
+    };
+    vkGetPhysicalDeviceFeatures2(device.handle, &features);
+    return vulkan12.drawIndirectCount;
+  }
+
+  /// Checks a single device, probes of different devices can run in parallel
+  static Option<Adapter> probe(
+    PhysicalDevice              device, 
+    const std::vector<Surface>& surfaces, 
+    std::ostream&               log
+  ) {
+    log 
+      << "Adapter[" 
+      << device.properties().deviceName
+      << "]" << std::endl;
 
     NameSet extensions = {
       VK_KHR_SWAPCHAIN_EXTENSION_NAME
     };
 
-    std::cout << "Looking for Adapter" << std::endl;
-    for (auto device : devices) {
-      std::cout 
-        << "Adapter[" 
-        << device.properties().deviceName
-        << "]" << std::endl;
-
-      if(!extensions.supported(device.extensions())) continue;
+    // Every window presents from the same queue
+    auto presents_to_all = [&](const QueueFamily& family) {
+      for(const auto& surface : surfaces) {
+        if(!device.can_present(family, surface) 
+        || !surface.compatible_with(device)) return false;
+      }
+      return true;
+    };
 
+    if(extensions.supported(device.extensions(), log)) {
       for(auto family : device.queue_families()) {
-        if(device.can_present(family, surface) && family.has_graphics()) {    
-          std::cout << "" << std::endl;
+        if(family.has_graphics() && presents_to_all(family)) {    
+          log << "" << std::endl;
+
+          // Optional, textures fall back to staging buffers without it
+          bool host_image_copy = supports_host_image_copy(device, log);
+          if(host_image_copy) {
+            extensions.add(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+            extensions.add(VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME);
+            extensions.add(VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME);
+          }
+
+          // Optional, the budget falls back to a share of each heap size
+          NameSet memory_budget = { VK_EXT_MEMORY_BUDGET_EXTENSION_NAME };
+          if(memory_budget.supported(device.extensions(), log)) {
+            extensions.add(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+          }
+
+          // Optional, sorted draws fall back to one vkCmdDrawIndexed per batch
+          auto supported = device.features();
+          PhysicalDevice::Features features {};
+          if(supported.multiDrawIndirect && supported.drawIndirectFirstInstance) {
+            features.multiDrawIndirect = VK_TRUE;
+            features.drawIndirectFirstInstance = VK_TRUE;
+          }
+
+          // Optional, objects are culled on the CPU without it
+          bool gpu_culling = supports_gpu_culling(device, family, features);
 
           return Adapter {
             .physical_device = device,
             .family = family,
             .extensions = extensions,
+            .features = features,
+            .host_image_copy = host_image_copy,
+            .gpu_culling = gpu_culling,
           };
         }
       }
+    }
+
+    log << "Rejected" << std::endl;
+    return {};
+  }
 
-      std::cout << "Rejected" << std::endl;
+  static Adapter from(
+    const Instance&             instance, 
+    const std::vector<Surface>& surfaces, 
+    ThreadPool&                 pool
+  ) {
+    constexpr auto score = [](PhysicalDevice device) {
+      auto prop = device.properties();
+      return (prop.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ? 10 : 1);
+    };
+    constexpr auto compare_device = [](PhysicalDevice left, PhysicalDevice right) {
+      return score(left) > score(right);
+    };
+
+    auto devices = instance.devices();
+    std::sort(devices.begin(), devices.end(), compare_device);
+
+    // Probe every device at once, logs are buffered to keep them readable
+    using Probe = std::pair<Option<Adapter>, std::string>;
+    std::vector<std::future<Probe>> probes;
+    for (auto device : devices) {
+      probes.push_back(pool.submit([device, &surfaces] {
+        std::ostringstream log;
+        auto adapter = probe(device, surfaces, log);
+        return Probe { std::move(adapter), log.str() };
+      }));
+    }
+
+    std::cout << "Looking for Adapter" << std::endl;
+    Option<Adapter> chosen;
+    std::exception_ptr error;
+    for (auto& pending : probes) {
+      // Later probes still reference `surfaces`, wait for all of them
+      // before an error unwinds the caller
+      try {
+        auto [adapter, log] = pending.get();
+        std::cout << log;
+
+        // Devices are in preference order, take the first suitable one
+        if(!chosen && adapter) chosen = std::move(adapter);
+      }
+      catch(...) {
+        if(!error) error = std::current_exception();
+      }
     }
+    if(error) std::rethrow_exception(error);
 
-    throw std::runtime_error("No suitable Adapter found");
+    if(!chosen) throw std::runtime_error("No suitable Adapter found");
+    return std::move(*chosen);
   }
 
   std::pair<Device, Queue> request_device() {
@@ -81,12 +212,32 @@ struct Adapter {
       .pQueuePriorities = &priority,
     };
 
+    void* next = nullptr;
+    VkPhysicalDeviceHostImageCopyFeaturesEXT host_image_copy_features {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT,
+      .hostImageCopy = VK_TRUE,
+    };
+    if(host_image_copy) {
+      host_image_copy_features.pNext = next;
+      next = &host_image_copy_features;
+    }
+    VkPhysicalDeviceVulkan12Features vulkan12_features {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+      .drawIndirectCount = VK_TRUE,
+    };
+    if(gpu_culling) {
+      vulkan12_features.pNext = next;
+      next = &vulkan12_features;
+    }
+
     VkDeviceCreateInfo info = {
       .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+      .pNext = next,
       .queueCreateInfoCount = 1,
       .pQueueCreateInfos = &queue_info,
       .enabledExtensionCount = extensions.count(),
-      .ppEnabledExtensionNames = extensions.names()
+      .ppEnabledExtensionNames = extensions.names(),
+      .pEnabledFeatures = &features,
     };
 
     auto device = physical_device.create_device(info);
@@ -123,6 +274,7 @@ Instance create_instance(bool validation_enabled) {
   Instance::CreateInfo info {
     .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO, 
     .pNext = &DebugLog::create_info,
+    .pApplicationInfo = &app_info,
     .enabledLayerCount = layers.count(),
     .ppEnabledLayerNames = layers.names(),
     .enabledExtensionCount = extensions.count(),
@@ -131,90 +283,264 @@ Instance create_instance(bool validation_enabled) {
   return Instance { info };
 }
 
-VkExtent2D swapchain_size(const VkSurfaceCapabilitiesKHR capabilities) {
-  auto current_extent = capabilities.currentExtent;
-  u32 special_dim = std::numeric_limits<u32>::max();
+struct VulkanState {
+  std::vector<GLFWwindow*> windows;
+
+  Instance instance;
+  Option<DebugLog> log;
+  std::vector<Surface> surfaces;
+
+  Device device;
+  Queue queue;
+  bool gpu_culling;
+
+  /// Startup is a small dependency graph, independent steps overlap:
+  ///
+  ///   instance + debug messenger (pool) ──┬──> surfaces ──> adapter probes (pool, per device) ──> device
+  ///   windows                    (main) ──┘
+  ///
+  /// Each phase is timed into `stats` under `startup.*`
+  template<typename CreateWindows>
+  static VulkanState make(
+    bool          validation_enabled, 
+    CreateWindows create_windows,
+    ThreadPool&   pool, 
+    Stats&        stats
+  ) {
+    Stopwatch total;
+
+    // The messenger is created in the same task, before any other Vulkan
+    // call can race it. The instance create info only covers vkCreateInstance
+    using Created = std::pair<Instance, Option<DebugLog>>;
+    auto pending_instance = pool.submit([&stats, validation_enabled] {
+      auto instance = timed(stats, "startup.instance_ms", [=] {
+        return create_instance(validation_enabled);
+      });
+      Option<DebugLog> log;
+      if(validation_enabled) log.emplace(instance.handle, true);
+      return Created { std::move(instance), std::move(log) };
+    });
+
+    // Window creation must stay on the main thread
+    std::vector<GLFWwindow*> windows = timed(stats, "startup.window_ms", create_windows);
+    auto [instance, log] = pending_instance.get();
+
+    auto surfaces = timed(stats, "startup.surface_ms", [&] {
+      std::vector<Surface> out;
+      for(auto window : windows) {
+        out.push_back(GLFW::create_surface(instance, window));
+      }
+      return out;
+    });
+    auto adapter = timed(stats, "startup.adapter_ms", [&] {
+      return Adapter::from(instance, surfaces, pool);
+    });
+    auto [device, queue] = timed(stats, "startup.device_ms", [&] {
+      return adapter.request_device();
+    });
+
+    stats.set("startup.vulkan_ms", total.elapsed_ms());
 
-  if (current_extent.width == special_dim 
-  && current_extent.height == special_dim) {
-    
+    return VulkanState {
+      .windows = std::move(windows),
+      .instance = std::move(instance),
+      .log = std::move(log),
+      .surfaces = std::move(surfaces),
+      .device = std::move(device),
+      .queue = std::move(queue),
+      .gpu_culling = adapter.gpu_culling,
+    };
   }
-  return current_extent;
-}
+};
 
-VkSwapchainCreateInfoKHR swapchain_config(
-  const Surface&        surface, 
-  const PhysicalDevice& device
-) {
-  auto limits = surface.get_limits(device);
+/// CPU against GPU frustum culling on the same random scenes as bench/cull,
+/// run with `--bench-cull`. The GPU columns stay empty without GPU culling
+void bench_culling(VulkanState& state) {
+  const u32 ITERATIONS = 10;
+  const u32 MAX_OBJECTS = 1'000'000;
+  std::mt19937 rng { 1234 };
+  std::uniform_real_distribution<f32> position(-500.0f, 500.0f);
+  std::uniform_real_distribution<f32> radius(0.5f, 4.0f);
+
+  auto frustum = Frustum::perspective(
+    { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f },
+    1.0f, 16.0f / 9.0f, 0.1f, 400.0f
+  );
 
-  VkSwapchainCreateInfoKHR info {
-    .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-    .surface = surface.handle, 
-    .minImageCount = limits.minImageCount + 1,     
+  Option<GpuCuller> culler;
+  if(state.gpu_culling) culler.emplace(state.device, state.queue, MAX_OBJECTS);
+
+  std::cout
+    << std::setw(10) << "objects"
+    << std::setw(12) << "cpu_visible"
+    << std::setw(10) << "cpu_ms"
+    << std::setw(12) << "gpu_visible"
+    << std::setw(10) << "gpu_ms"
+    << std::setw(14) << "gpu_wall_ms" << std::endl;
+
+  for(u32 count : { 10'000u, 100'000u, 1'000'000u }) {
+    std::vector<Sphere> spheres(count);
+    std::vector<GpuCuller::Object> objects(count);
+    for(u32 i = 0; i < count; i++) {
+      spheres[i] = { { position(rng), position(rng), position(rng) }, radius(rng) };
+      objects[i] = { .bounds = spheres[i], .index_count = 36, .id = i };
+    }
 
-    .presentMode = VK_PRESENT_MODE_FIFO_KHR
-  };
+    std::vector<u32> visible;
+    visible.reserve(count);
+
+    f64 cpu = 1e9;
+    for(u32 i = 0; i < ITERATIONS; i++) {
+      Stopwatch watch;
+      cull(spheres, frustum, visible);
+      cpu = std::min(cpu, watch.elapsed_ms());
+    }
+
+    std::cout << std::fixed << std::setprecision(3)
+      << std::setw(10) << count
+      << std::setw(12) << visible.size()
+      << std::setw(10) << cpu;
+
+    if(!culler) {
+      std::cout << std::setw(12) << "-" << std::setw(10) << "-" << std::setw(14) << "-" << std::endl;
+      continue;
+    }
 
-  for(auto mode : surface.get_present_modes(device)) {
-    if(mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-      info.presentMode = mode;
-      break; 
+    // Wall time covers recording, submission and the wait on top of the pass
+    culler->set_objects(objects);
+    f64 gpu = 1e9, wall = 1e9;
+    Stats stats;
+    for(u32 i = 0; i < ITERATIONS; i++) {
+      Stopwatch watch;
+      culler->cull(frustum, stats);
+      culler->finish(stats);
+      wall = std::min(wall, watch.elapsed_ms());
+      gpu = std::min(gpu, stats.get("cull.gpu_ms"));
     }
+
+    // Without timestamps on the queue only the wall time is known
+    std::cout << std::setw(12) << static_cast<u64>(stats.get("cull.gpu_visible"));
+    if(stats.values.contains("cull.gpu_ms")) std::cout << std::setw(10) << gpu;
+    else std::cout << std::setw(10) << "-";
+    std::cout << std::setw(14) << wall << std::endl;
   }
+}
 
-  for(auto fmt : surface.get_formats(device)) {
-    if(fmt.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR
-    && fmt.format == VK_FORMAT_B8G8R8_SRGB) {
-      info.imageFormat = fmt.format;
-      info.imageColorSpace = fmt.colorSpace;
-      break;
+/// RGBA8 checkerboard that provides level 0 and `coarse_level`, every other
+/// level is generated. Each provided level gets its own colour
+TextureSource checkerboard(u32 size, u32 coarse_level, bool host_copy) {
+  std::vector<std::vector<u8>> levels(coarse_level + 1);
+  for(u32 level : { 0u, coarse_level }) {
+    u32 side = std::max(size >> level, 1u);
+    auto& texels = levels[level];
+    texels.resize(side * side * 4);
+
+    for(u32 y = 0; y < side; y++) {
+      for(u32 x = 0; x < side; x++) {
+        bool dark = ((x / 8) ^ (y / 8)) & 1;
+        u8* texel = &texels[(y * side + x) * 4];
+        texel[0] = dark ? 32 : 224;
+        texel[1] = level == 0 ? texel[0] : 64;
+        texel[2] = level == 0 ? texel[0] : 192;
+        texel[3] = 255;
+      }
     }
   }
 
-  return info;
+  return TextureSource {
+    .format = VK_FORMAT_R8G8B8A8_UNORM,
+    .size = { size, size },
+    .texel_bytes = 4,
+    .provided = 1u | (1u << coarse_level),
+    .load = [levels = std::move(levels)](u32 level) {
+      return std::span<const u8> { levels[level] };
+    },
+    .host_copy = host_copy,
+  };
 }
 
-struct VulkanState {
-  Instance instance;
-  Option<DebugLog> log;
-  Surface surface;
+void run_frames(VulkanState& state, ThreadPool& pool, Stats& startup, const Stopwatch& launch) {
+  auto& windows = state.windows;
+
+  std::vector<Presenter::Target> targets;
+  for(u32 i = 0; i < windows.size(); i++) {
+    auto window = windows[i];
+    f32 shade = static_cast<f32>(i + 1) / windows.size();
+
+    targets.push_back({
+      .surface = &state.surfaces[i],
+      .framebuffer_size = [window] {
+        i32 width = 0, height = 0;
+        glfwGetFramebufferSize(window, &width, &height);
+        return VkExtent2D { u32(width), u32(height) };
+      },
+      .clear_color = { .float32 = { 0.1f, 0.2f * shade, 0.4f * shade, 1.0f } },
+    });
+  }
+  Presenter presenter { state.device, state.queue, std::move(targets), pool };
+  TextureStreamer textures { state.device, state.queue, {} };
+  FrameAllocator frame_data { state.device, {} };
+
+  // Stand-ins until there are materials. One per upload path, the host image
+  // copy one falls back to staging where the device has no host image copy
+  std::vector<TextureStreamer::Id> streamed = {
+    textures.create(checkerboard(512, 4, true)),
+    textures.create(checkerboard(512, 4, false)),
+  };
 
-  Device device;
-  Queue queue;
+  Stats stats;
+  Stopwatch report;
+  u64 frame = 0;
 
-  static VulkanState make(bool validation_enabled, GLFWwindow* window) {
-    Instance instance = create_instance(validation_enabled);
+  auto any_closed = [&] {
+    for(auto window : windows) {
+      if(glfwWindowShouldClose(window)) return true;
+    }
+    return false;
+  };
 
-    Option<DebugLog> log;
-    if (validation_enabled) 
-      log = std::move(DebugLog { instance.handle, validation_enabled });
-    Surface surface = GLFW::create_surface(instance, window);
+  while (!any_closed()) {
+    glfwPollEvents();
+    state.device.budget->begin_frame(frame);
+    frame_data.begin_frame(frame);
+    for(auto id : streamed) textures.touch(id, frame);
+    textures.update(frame, stats);
 
-    auto adapter = Adapter::from(instance, surface);
-    auto [device, queue] = adapter.request_device();
-    
-    auto config = swapchain_config(surface, adapter.physical_device);
-    //surface.setup_swapchain(device, config);
+    presenter.frame(stats);
+    state.device.budget->report(stats);
+    frame_data.report(stats);
 
-    return VulkanState {
-      .instance = std::move(instance),
-      .log = std::move(log),
-      .surface = std::move(surface),
-      .device = std::move(device),
-      .queue = std::move(queue)
-    };
+    if(frame == 0) {
+      startup.set("startup.first_frame_ms", launch.elapsed_ms());
+      std::cout << "Startup" << std::endl << startup;
+    }
+
+    if(report.elapsed_ms() > 1000.0) {
+      std::cout << "Frame " << frame << std::endl << stats;
+      report.restart();
+    }
+    frame++;
   }
-};
 
-int vulkan_test() {
+  // Swapchains and their semaphores go with the presenter, the presentation
+  // engine may still wait on them past its fence
+  vkDeviceWaitIdle(state.device.handle);
+}
+
+int vulkan_test(bool bench_cull) {
 #ifdef DEBUG 
   const bool VALIDATION_ENABLED = true;
 #else 
   const bool VALIDATION_ENABLED = false;
 #endif 
+  // The culling bench is headless, no surfaces also means no present checks
+  const u32 WINDOW_COUNT = bench_cull ? 0 : 2;
 
-  if(!glfwInit()) {
+  Stopwatch launch;
+  Stats startup;
+  ThreadPool pool;
+
+  if(!timed(startup, "startup.glfw_ms", glfwInit)) {
     std::cout << "GLFW init failed";
     return EXIT_FAILURE;
   }
@@ -233,25 +559,37 @@ int vulkan_test() {
     std::cout << "Vulkan " << Instance::version() << std::endl;
   }
 
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-  GLFWwindow* window = glfwCreateWindow(500, 500, "Hello Vulkan", nullptr, nullptr);
-
+  std::vector<GLFWwindow*> windows;
   {
-    auto state = VulkanState::make(VALIDATION_ENABLED, window);
+    auto create_windows = [&] {
+      glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+      glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+
+      std::vector<GLFWwindow*> out;
+      for(u32 i = 0; i < WINDOW_COUNT; i++) {
+        auto title = "Hello Vulkan [" + std::to_string(i) + "]";
+        out.push_back(glfwCreateWindow(500, 500, title.c_str(), nullptr, nullptr));
+      }
+      return out;
+    };
+    auto state = VulkanState::make(VALIDATION_ENABLED, create_windows, pool, startup);
+    windows = state.windows;
 
-    while (!glfwWindowShouldClose(window)) {
-      glfwPollEvents();
-    }
+    if(bench_cull) bench_culling(state);
+    else run_frames(state, pool, startup, launch);
+    vkDeviceWaitIdle(state.device.handle);
   }
 
-  glfwDestroyWindow(window);
+  for(auto window : windows) {
+    glfwDestroyWindow(window);
+  }
   glfwTerminate();
 
   return EXIT_SUCCESS;
 }
 
-int main() {
-  vulkan_test();
+int main(int argc, char** argv) {
+  bool bench_cull = argc > 1 && std::string_view { argv[1] } == "--bench-cull";
+  vulkan_test(bench_cull);
   return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "memory.hpp"
+#include <algorithm>
+#include <string>
+
+const char* to_string(MemoryCategory category) {
+  switch(category) {
+    case MemoryCategory::Texture:      return "texture";
+    case MemoryCategory::Buffer:       return "buffer";
+    case MemoryCategory::RenderTarget: return "render_target";
+    case MemoryCategory::Staging:      return "staging";
+  }
+  return "unknown";
+}
+
+
+
+MemoryBudget::MemoryBudget(PhysicalDevice physical, bool has_budget_extension)
+: m_physical(physical), m_has_budget_extension(has_budget_extension),
+  m_properties(physical.memory_properties()),
+  m_heaps(m_properties.memoryHeapCount)
+{
+  for(u32 i = 0; i < m_properties.memoryHeapCount; i++) {
+    m_heaps[i].size = m_properties.memoryHeaps[i].size;
+  }
+  begin_frame(0);
+}
+
+void MemoryBudget::begin_frame(u64 frame) {
+  m_frame = frame;
+  m_evictions = 0;
+
+  if(!m_has_budget_extension) {
+    // Without driver numbers leave room for everything else sharing the heap
+    for(auto& heap : m_heaps) {
+      heap.budget = heap.size / 10 * 8;
+    }
+    return;
+  }
+
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budget {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+  };
+  VkPhysicalDeviceMemoryProperties2 props {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+    .pNext = &budget,
+  };
+  vkGetPhysicalDeviceMemoryProperties2(m_physical.handle, &props);
+
+  for(u32 i = 0; i < m_heaps.size(); i++) {
+    auto& heap = m_heaps[i];
+    heap.budget = budget.heapBudget[i];
+    heap.reported = budget.heapUsage[i];
+    heap.tracked_at_refresh = heap.tracked;
+  }
+}
+
+bool MemoryBudget::reserve(u32 memory_type, VkDeviceSize size) {
+  u32 heap = heap_of_type(memory_type);
+
+  while(m_heaps[heap].usage() + size > m_heaps[heap].budget) {
+    if(!evict_one(heap)) {
+      m_failed_reserves++;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MemoryBudget::evict_one(u32 heap) {
+  // An evictable that allocates while evicting must not start another eviction
+  if(m_evicting) return false;
+
+  Evictable* oldest = nullptr;
+  u64 oldest_frame = 0;
+
+  for(auto evictable : m_evictables) {
+    auto frame = evictable->oldest_use(heap, m_frame);
+    if(frame && (!oldest || *frame < oldest_frame)) {
+      oldest = evictable;
+      oldest_frame = *frame;
+    }
+  }
+  if(!oldest) return false;
+
+  // Only counts when memory came back, an evictable that frees nothing
+  // would otherwise keep the caller spinning
+  auto before = m_heaps[heap].tracked;
+  m_evicting = true;
+  oldest->evict_oldest(heap, m_frame);
+  m_evicting = false;
+  if(m_heaps[heap].tracked >= before) return false;
+
+  m_evictions++;
+  m_evictions_total++;
+  return true;
+}
+
+
+
+void MemoryBudget::track(
+  VkDeviceMemory memory,
+  u32            memory_type,
+  VkDeviceSize   size,
+  MemoryCategory category
+) {
+  u32 heap = heap_of_type(memory_type);
+  m_allocations[memory] = { heap, size, category };
+
+  m_heaps[heap].tracked += size;
+  m_heaps[heap].by_category[static_cast<u32>(category)] += size;
+}
+
+void MemoryBudget::untrack(VkDeviceMemory memory) {
+  auto it = m_allocations.find(memory);
+  if(it == m_allocations.end()) return;
+
+  auto [heap, size, category] = it->second;
+  m_heaps[heap].tracked -= size;
+  m_heaps[heap].by_category[static_cast<u32>(category)] -= size;
+  m_allocations.erase(it);
+}
+
+Option<u32> MemoryBudget::heap_of(VkDeviceMemory memory) const {
+  auto it = m_allocations.find(memory);
+  if(it == m_allocations.end()) return {};
+  return it->second.heap;
+}
+
+void MemoryBudget::add_evictable(Evictable* evictable) {
+  m_evictables.push_back(evictable);
+}
+void MemoryBudget::remove_evictable(Evictable* evictable) {
+  m_evictables.erase(
+    std::remove(m_evictables.begin(), m_evictables.end(), evictable),
+    m_evictables.end()
+  );
+}
+
+
+
+void MemoryBudget::report(Stats& stats) const {
+  for(u32 i = 0; i < m_heaps.size(); i++) {
+    const auto& heap = m_heaps[i];
+    auto prefix = "memory.heap" + std::to_string(i) + ".";
+
+    stats.set(prefix + "budget",   static_cast<f64>(heap.budget));
+    stats.set(prefix + "usage",    static_cast<f64>(heap.usage()));
+    stats.set(prefix + "headroom", static_cast<f64>(heap.headroom()));
+
+    for(u32 c = 0; c < MEMORY_CATEGORY_COUNT; c++) {
+      auto category = static_cast<MemoryCategory>(c);
+      stats.set(prefix + to_string(category), static_cast<f64>(heap.by_category[c]));
+    }
+  }
+
+  stats.set("memory.evictions",       m_evictions);
+  stats.set("memory.evictions_total", m_evictions_total);
+  stats.set("memory.failed_reserves", m_failed_reserves);
+}
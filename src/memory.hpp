@@ -0,0 +1,97 @@
+#pragma once
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+#include "stats.hpp"
+
+const char* to_string(MemoryCategory category);
+
+/// A subsystem holding resources it can demote or drop under memory pressure
+struct Evictable {
+  virtual ~Evictable() = default;
+
+  /// Frame the least recently used evictable resource on `heap` was last used in
+  virtual Option<u64> oldest_use(u32 heap, u64 frame) const = 0;
+  /// Demotes or drops that resource
+  virtual void evict_oldest(u32 heap, u64 frame) = 0;
+};
+
+/// Tracks device memory per heap and per category against the driver budget.
+///
+/// Uses VK_EXT_memory_budget when enabled, otherwise budgets a fixed share
+/// of each heap size and counts only our own allocations as usage
+class MemoryBudget {
+public:
+  struct Heap {
+    VkDeviceSize size = 0;
+    VkDeviceSize budget = 0;
+
+    // Driver reported usage at the last refresh, includes other processes
+    VkDeviceSize reported = 0;
+    VkDeviceSize tracked_at_refresh = 0;
+
+    VkDeviceSize tracked = 0;
+    std::array<VkDeviceSize, MEMORY_CATEGORY_COUNT> by_category {};
+
+    /// Reported usage adjusted by what we allocated or freed since the refresh
+    VkDeviceSize usage() const {
+      if(tracked >= tracked_at_refresh) {
+        return reported + (tracked - tracked_at_refresh);
+      }
+      return reported - std::min(reported, tracked_at_refresh - tracked);
+    }
+    VkDeviceSize headroom() const {
+      return budget > usage() ? budget - usage() : 0;
+    }
+  };
+
+  MemoryBudget(PhysicalDevice physical, bool has_budget_extension);
+
+  /// Re-queries driver budgets, call once per frame
+  void begin_frame(u64 frame);
+
+  /// Evicts least recently used resources until `size` fits in the heap of `memory_type`
+  bool reserve(u32 memory_type, VkDeviceSize size);
+  /// Last resort after an allocation failed, evicts the single oldest resource
+  bool evict_one(u32 heap);
+
+  void track(VkDeviceMemory memory, u32 memory_type, VkDeviceSize size, MemoryCategory category);
+  void untrack(VkDeviceMemory memory);
+
+  void add_evictable(Evictable* evictable);
+  void remove_evictable(Evictable* evictable);
+
+  u32 heap_of_type(u32 memory_type) const {
+    return m_properties.memoryTypes[memory_type].heapIndex;
+  }
+  Option<u32> heap_of(VkDeviceMemory memory) const;
+
+  const std::vector<Heap>& heaps() const {
+    return m_heaps;
+  }
+
+  void report(Stats& stats) const;
+
+private:
+  struct Allocation {
+    u32 heap;
+    VkDeviceSize size;
+    MemoryCategory category;
+  };
+
+  PhysicalDevice m_physical;
+  bool m_has_budget_extension;
+  PhysicalDevice::MemoryProperties m_properties;
+
+  std::vector<Heap> m_heaps;
+  std::unordered_map<VkDeviceMemory, Allocation> m_allocations;
+  std::vector<Evictable*> m_evictables;
+
+  u64 m_frame = 0;
+  bool m_evicting = false;
+  u32 m_evictions = 0;
+  u32 m_evictions_total = 0;
+  u32 m_failed_reserves = 0;
+};
@@ -1,22 +1,34 @@
 #pragma once
 #include <vector>
 #include <algorithm>
+#include <cstring>
+
+#include <iostream>
+#include <vulkan/vulkan.h>
 
 #include "types.hpp"
-#include "common.hpp"
 
 
 
 class NameSet {
   std::vector<const char*> m_data;
 
+  // Names are compared by contents, pointers from different sources 
+  // (string literals, driver owned strings) may differ for the same name
+  static bool less(const char* lhs, const char* rhs) {
+    return std::strcmp(lhs, rhs) < 0;
+  }
+  static bool equal(const char* lhs, const char* rhs) {
+    return std::strcmp(lhs, rhs) == 0;
+  }
+
   void sort() {
-    std::sort(m_data.begin(), m_data.end());
+    std::sort(m_data.begin(), m_data.end(), less);
   }
   void remove_duplicates() {
     sort();
     m_data.erase(
-      std::unique(m_data.begin(), m_data.end()), 
+      std::unique(m_data.begin(), m_data.end(), equal), 
       m_data.end()
     );
   }
@@ -29,8 +41,8 @@ public:
     remove_duplicates();
   }
 
-  bool find(const char* name) {
-    return std::binary_search(m_data.begin(), m_data.end(), name);
+  bool find(const char* name) const {
+    return std::binary_search(m_data.begin(), m_data.end(), name, less);
   }
 
   void add(const char* name) {
@@ -47,12 +59,12 @@ public:
   }
 
   template<typename Property, typename Fn>
-  bool impl_supported(const std::vector<Property>& available, Fn get_name) const {
+  bool impl_supported(const std::vector<Property>& available, Fn get_name, std::ostream& log) const {
     bool any_missing = false;
     for (auto name : m_data) {
       bool found = false;
 
-      for (auto property : available) {
+      for (const auto& property : available) {
         if (std::strcmp(name, get_name(property)) == 0) {
           found = true;
           break;
@@ -60,7 +72,7 @@ public:
       } 
 
       if(!found) any_missing = true;
-      std::cerr
+      log
         << (found ? "[X]" : "[ ]") 
         << " : " << name << std::endl; 
     }
@@ -68,17 +80,23 @@ public:
     return !any_missing;
   }
 
-  bool supported(const std::vector<VkLayerProperties>& available) const {
-    std::cout << "Checking Layer Support" << std::endl;
+  bool supported(
+    const std::vector<VkLayerProperties>& available, 
+    std::ostream& log = std::cerr
+  ) const {
+    log << "Checking Layer Support" << std::endl;
     bool any_missing = false;
     return impl_supported<VkLayerProperties>(available, 
-      [](auto layer) { return layer.layerName; }
+      [](const auto& layer) { return layer.layerName; }, log
     );
   }
-  bool supported(const std::vector<VkExtensionProperties>& available) const {
-    std::cout << "Checking Extension Support" << std::endl;
+  bool supported(
+    const std::vector<VkExtensionProperties>& available, 
+    std::ostream& log = std::cerr
+  ) const {
+    log << "Checking Extension Support" << std::endl;
     return impl_supported<VkExtensionProperties>(available, 
-      [](auto extension) { return extension.extensionName; }
+      [](const auto& extension) { return extension.extensionName; }, log
     );
   }
 };
\ No newline at end of file
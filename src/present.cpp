@@ -0,0 +1,269 @@
+#include "present.hpp"
+#include <limits>
+#include <string>
+
+VkExtent2D swapchain_size(
+  const VkSurfaceCapabilitiesKHR capabilities,
+  VkExtent2D                     framebuffer_size
+) {
+  auto current_extent = capabilities.currentExtent;
+  u32 special_dim = std::numeric_limits<u32>::max();
+
+  // The surface lets the swapchain decide, follow the window
+  if (current_extent.width == special_dim
+  && current_extent.height == special_dim) {
+    return {
+      .width = std::clamp(framebuffer_size.width,
+        capabilities.minImageExtent.width, capabilities.maxImageExtent.width),
+      .height = std::clamp(framebuffer_size.height,
+        capabilities.minImageExtent.height, capabilities.maxImageExtent.height),
+    };
+  }
+  return current_extent;
+}
+
+VkSwapchainCreateInfoKHR swapchain_config(
+  const Surface&        surface,
+  const PhysicalDevice& device,
+  VkExtent2D            framebuffer_size
+) {
+  auto limits = surface.get_limits(device);
+
+  u32 image_count = limits.minImageCount + 1;
+  if (limits.maxImageCount != 0) {
+    image_count = std::min(image_count, limits.maxImageCount);
+  }
+
+  VkSwapchainCreateInfoKHR info {
+    .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+    .surface = surface.handle,
+    .minImageCount = image_count,
+    .imageExtent = swapchain_size(limits, framebuffer_size),
+    .imageArrayLayers = 1,
+    .imageUsage
+      = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+      | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+    .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .preTransform = limits.currentTransform,
+    .presentMode = VK_PRESENT_MODE_FIFO_KHR,
+    .clipped = VK_TRUE,
+  };
+
+  // At least one mode is always supported, the lowest bit is OPAQUE when it is
+  auto alpha = limits.supportedCompositeAlpha;
+  info.compositeAlpha = static_cast<VkCompositeAlphaFlagBitsKHR>(alpha & (~alpha + 1));
+
+  for(auto mode : surface.get_present_modes(device)) {
+    if(mode == VK_PRESENT_MODE_MAILBOX_KHR) {
+      info.presentMode = mode;
+      break;
+    }
+  }
+
+  auto formats = surface.get_formats(device);
+  info.imageFormat = formats[0].format;
+  info.imageColorSpace = formats[0].colorSpace;
+  for(auto fmt : formats) {
+    if(fmt.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR
+    && fmt.format == VK_FORMAT_B8G8R8A8_SRGB) {
+      info.imageFormat = fmt.format;
+      info.imageColorSpace = fmt.colorSpace;
+      break;
+    }
+  }
+
+  return info;
+}
+
+
+
+Presenter::Presenter(
+  const Device&       device,
+  Queue               queue,
+  std::vector<Target> targets,
+  ThreadPool&         pool
+) : m_device(device), m_queue(queue), m_pool(pool), m_fence(device, true) {
+  m_outputs.reserve(targets.size());
+  for(auto& target : targets) {
+    CommandPool commands { device, queue.family };
+    auto cmd = commands.allocate();
+
+    m_outputs.push_back(Output {
+      .target = std::move(target),
+      .pool = std::move(commands),
+      .cmd = cmd,
+      .acquired = Semaphore { device },
+    });
+  }
+}
+Presenter::~Presenter() {
+  m_fence.wait();
+}
+
+void Presenter::rebuild(Output& output) {
+  auto size = output.target.framebuffer_size();
+  auto info = swapchain_config(*output.target.surface, m_device.physical, size);
+
+  // Minimized, try again next frame
+  if(info.imageExtent.width == 0 || info.imageExtent.height == 0) return;
+
+  info.oldSwapchain = output.swapchain ? output.swapchain->handle : VK_NULL_HANDLE;
+  Swapchain swapchain { m_device, info };
+
+  // Once every image of the new swapchain went through presentation the
+  // old presents have finished, they are queued in order
+  if(output.swapchain) {
+    output.retired.push_back(Output::Retired {
+      .swapchain = std::move(*output.swapchain),
+      .rendered = std::move(output.rendered),
+      .retire_after = output.presents + swapchain.images.size(),
+    });
+  }
+  output.swapchain.reset();
+  output.swapchain.emplace(std::move(swapchain));
+
+  output.rendered.clear();
+  for(size_t i = 0; i < output.swapchain->images.size(); i++) {
+    output.rendered.emplace_back(m_device);
+  }
+  output.stale = false;
+}
+
+bool Presenter::record(Output& output) {
+  if(!output.swapchain) return false;
+
+  VkResult res = vkAcquireNextImageKHR(
+    m_device.handle, output.swapchain->handle, UINT64_MAX,
+    output.acquired.handle, VK_NULL_HANDLE, &output.image
+  );
+  if(res == VK_ERROR_OUT_OF_DATE_KHR) {
+    output.stale = true;
+    return false;
+  }
+  if(res == VK_SUBOPTIMAL_KHR) output.stale = true;
+  else Error::check(res);
+
+  auto image = output.swapchain->images[output.image];
+  VkImageSubresourceRange range { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+  VkCommandBufferBeginInfo begin {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  Error::check(vkResetCommandBuffer(output.cmd, 0));
+  Error::check(vkBeginCommandBuffer(output.cmd, &begin));
+
+  image_barrier(output.cmd, image, 0, 1,
+    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+  );
+  vkCmdClearColorImage(output.cmd, image,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &output.target.clear_color, 1, &range
+  );
+  image_barrier(output.cmd, image, 0, 1,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+  );
+
+  Error::check(vkEndCommandBuffer(output.cmd));
+  return true;
+}
+
+void Presenter::frame(Stats& stats) {
+  m_fence.wait();
+
+  // Retired in order, the oldest swapchain is always in front
+  for(auto& output : m_outputs) {
+    while(!output.retired.empty()
+    && output.presents >= output.retired.front().retire_after) {
+      output.retired.pop_front();
+    }
+  }
+
+  // Swapchain creation talks to the window system, keep it on this thread
+  bool any_stale = std::any_of(m_outputs.begin(), m_outputs.end(),
+    [](const Output& output) { return output.stale; }
+  );
+  if(any_stale) {
+    Error::check(vkQueueWaitIdle(m_queue.handle));
+    for(auto& output : m_outputs) {
+      if(output.stale) rebuild(output);
+    }
+  }
+
+  // Every output has its own command pool, so they can record side by side
+  std::vector<std::future<bool>> recording;
+  for(u32 i = 0; i < m_outputs.size(); i++) {
+    recording.push_back(m_pool.submit([this, i, &stats] {
+      return timed(stats, "window" + std::to_string(i) + ".record_ms", [&] {
+        return record(m_outputs[i]);
+      });
+    }));
+  }
+
+  std::vector<VkSubmitInfo> submits;
+  std::vector<VkSwapchainKHR> swapchains;
+  std::vector<u32> images;
+  std::vector<VkSemaphore> rendered;
+  std::vector<u32> presented;
+
+  VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  for(u32 i = 0; i < m_outputs.size(); i++) {
+    if(!recording[i].get()) continue;
+
+    auto& output = m_outputs[i];
+    presented.push_back(i);
+    swapchains.push_back(output.swapchain->handle);
+    images.push_back(output.image);
+    rendered.push_back(output.rendered[output.image].handle);
+
+    submits.push_back(VkSubmitInfo {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .waitSemaphoreCount = 1,
+      .pWaitSemaphores = &output.acquired.handle,
+      .pWaitDstStageMask = &wait_stage,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &output.cmd,
+      .signalSemaphoreCount = 1,
+      .pSignalSemaphores = &output.rendered[output.image].handle,
+    });
+  }
+  if(submits.empty()) return;
+
+  m_fence.reset();
+  timed(stats, "present.submit_ms", [&] {
+    Error::check(vkQueueSubmit(
+      m_queue.handle, static_cast<u32>(submits.size()), submits.data(), m_fence.handle
+    ));
+  });
+
+  std::vector<VkResult> results(swapchains.size());
+  VkPresentInfoKHR present {
+    .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+    .waitSemaphoreCount = static_cast<u32>(rendered.size()),
+    .pWaitSemaphores = rendered.data(),
+    .swapchainCount = static_cast<u32>(swapchains.size()),
+    .pSwapchains = swapchains.data(),
+    .pImageIndices = images.data(),
+    .pResults = results.data(),
+  };
+  VkResult res = timed(stats, "present.ms", [&] {
+    return vkQueuePresentKHR(m_queue.handle, &present);
+  });
+  stats.set("present.swapchains", static_cast<f64>(swapchains.size()));
+
+  if(res != VK_ERROR_OUT_OF_DATE_KHR && res != VK_SUBOPTIMAL_KHR) {
+    Error::check(res);
+  }
+  for(size_t i = 0; i < presented.size(); i++) {
+    auto& output = m_outputs[presented[i]];
+    if(results[i] == VK_ERROR_OUT_OF_DATE_KHR || results[i] == VK_SUBOPTIMAL_KHR) {
+      output.stale = true;
+    }
+
+    stats.set(
+      "window" + std::to_string(presented[i]) + ".frame_ms", 
+      output.since_present.elapsed_ms()
+    );
+    output.since_present.restart();
+    output.presents++;
+  }
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <deque>
+#include <vector>
+
+#include "common.hpp"
+#include "resource.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+
+/// Presents to several surfaces from one device and queue.
+///
+/// Each output is recorded on its own pool thread, then every output is
+/// submitted in one vkQueueSubmit and presented in one vkQueuePresentKHR.
+/// Outputs are only cleared for now, there is no drawing yet
+class Presenter {
+public:
+  struct Target {
+    const Surface* surface;
+    /// Used when the surface leaves the extent up to the swapchain
+    std::function<VkExtent2D()> framebuffer_size;
+    VkClearColorValue clear_color;
+  };
+
+  Presenter(
+    const Device&       device,
+    Queue               queue,
+    std::vector<Target> targets,
+    ThreadPool&         pool
+  );
+  ~Presenter();
+
+  Presenter(Presenter&&) = delete;
+
+  /// Records, submits and presents one frame on every output
+  void frame(Stats& stats);
+
+  u32 count() const {
+    return static_cast<u32>(m_outputs.size());
+  }
+
+private:
+  struct Output {
+    Target target;
+    Option<Swapchain> swapchain;
+    bool stale = true;
+
+    CommandPool pool;
+    VkCommandBuffer cmd;
+
+    Semaphore acquired;
+    // One per swapchain image, presentation may still hold the previous one
+    std::vector<Semaphore> rendered;
+
+    // Replaced swapchains keep their semaphores, presentation may still be
+    // waiting on them after a queue wait. Destroyed once `retire_after` passes
+    struct Retired {
+      Swapchain swapchain;
+      std::vector<Semaphore> rendered;
+      u64 retire_after;
+    };
+    std::deque<Retired> retired;
+
+    u32 image = 0;
+    u64 presents = 0;
+    Stopwatch since_present;
+  };
+
+  const Device& m_device;
+  Queue m_queue;
+  ThreadPool& m_pool;
+  Fence m_fence;
+  std::vector<Output> m_outputs;
+
+  void rebuild(Output& output);
+  bool record(Output& output);
+};
@@ -0,0 +1,39 @@
+#include "range_allocator.hpp"
+#include <iterator>
+
+
+
+RangeAllocator::RangeAllocator(u64 capacity) {
+  if(capacity > 0) m_free[0] = capacity;
+}
+
+Option<u64> RangeAllocator::allocate(u64 size) {
+  for(auto it = m_free.begin(); it != m_free.end(); it++) {
+    auto [offset, length] = *it;
+    if(length < size) continue;
+
+    m_free.erase(it);
+    if(length > size) m_free[offset + size] = length - size;
+    m_used += size;
+    return offset;
+  }
+  return {};
+}
+
+void RangeAllocator::free(u64 offset, u64 size) {
+  m_used -= size;
+  auto next = m_free.lower_bound(offset);
+
+  if(next != m_free.end() && offset + size == next->first) {
+    size += next->second;
+    next = m_free.erase(next);
+  }
+  if(next != m_free.begin()) {
+    auto prev = std::prev(next);
+    if(prev->first + prev->second == offset) {
+      prev->second += size;
+      return;
+    }
+  }
+  m_free[offset] = size;
+}
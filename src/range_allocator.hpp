@@ -0,0 +1,22 @@
+#pragma once
+#include <map>
+
+#include "types.hpp"
+
+/// First fit allocator over [0, capacity), neighbouring free ranges are joined
+class RangeAllocator {
+public:
+  explicit RangeAllocator(u64 capacity);
+
+  Option<u64> allocate(u64 size);
+  void free(u64 offset, u64 size);
+
+  u64 used() const {
+    return m_used;
+  }
+
+private:
+  // Offset to size of every free range
+  std::map<u64, u64> m_free;
+  u64 m_used = 0;
+};
@@ -0,0 +1,223 @@
+#include "resource.hpp"
+#include <utility>
+
+
+
+Buffer::Buffer(
+  const Device&         device,
+  VkDeviceSize          size,
+  VkBufferUsageFlags    usage,
+  VkMemoryPropertyFlags flags,
+  MemoryCategory        category
+) : size(size), device(&device) {
+  VkBufferCreateInfo info {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = size,
+    .usage = usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+  };
+  Error::check(vkCreateBuffer(device.handle, &info, nullptr, &handle));
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(device.handle, handle, &requirements);
+
+  memory = device.allocate(requirements, flags, category);
+  Error::check(vkBindBufferMemory(device.handle, handle, memory, 0));
+
+  if(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    Error::check(vkMapMemory(device.handle, memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+  }
+}
+Buffer::~Buffer() {
+  if(handle != VK_NULL_HANDLE) {
+    vkDestroyBuffer(device->handle, handle, nullptr);
+    device->free(memory);
+  }
+}
+Buffer::Buffer(Buffer&& other) {
+  handle = std::exchange(other.handle, VK_NULL_HANDLE);
+  memory = std::exchange(other.memory, VK_NULL_HANDLE);
+  size   = other.size;
+  mapped = std::exchange(other.mapped, nullptr);
+  device = other.device;
+}
+Buffer& Buffer::operator=(Buffer&& other) {
+  std::swap(handle, other.handle);
+  std::swap(memory, other.memory);
+  std::swap(size,   other.size);
+  std::swap(mapped, other.mapped);
+  std::swap(device, other.device);
+  return *this;
+}
+
+
+
+Image::Image(const Device& device, Config config)
+: config(config), device(&device) {
+  VkImageCreateInfo info {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = config.format,
+    .extent = { config.size.width, config.size.height, 1 },
+    .mipLevels = config.levels,
+    .arrayLayers = 1,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = config.usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  Error::check(vkCreateImage(device.handle, &info, nullptr, &handle));
+
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(device.handle, handle, &requirements);
+  bytes = requirements.size;
+
+  memory = device.allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, config.category);
+  Error::check(vkBindImageMemory(device.handle, handle, memory, 0));
+
+  VkImageViewCreateInfo view_info {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = handle,
+    .viewType = VK_IMAGE_VIEW_TYPE_2D,
+    .format = config.format,
+    .subresourceRange = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .baseMipLevel = 0,
+      .levelCount = config.levels,
+      .baseArrayLayer = 0,
+      .layerCount = 1,
+    },
+  };
+  Error::check(vkCreateImageView(device.handle, &view_info, nullptr, &view));
+}
+Image::~Image() {
+  if(handle != VK_NULL_HANDLE) {
+    vkDestroyImageView(device->handle, view, nullptr);
+    vkDestroyImage(device->handle, handle, nullptr);
+    device->free(memory);
+  }
+}
+Image::Image(Image&& other) {
+  handle = std::exchange(other.handle, VK_NULL_HANDLE);
+  memory = std::exchange(other.memory, VK_NULL_HANDLE);
+  view   = std::exchange(other.view, VK_NULL_HANDLE);
+  config = other.config;
+  bytes  = other.bytes;
+  device = other.device;
+}
+Image& Image::operator=(Image&& other) {
+  std::swap(handle, other.handle);
+  std::swap(memory, other.memory);
+  std::swap(view,   other.view);
+  std::swap(config, other.config);
+  std::swap(bytes,  other.bytes);
+  std::swap(device, other.device);
+  return *this;
+}
+
+void image_barrier(
+  VkCommandBuffer cmd,
+  VkImage         image,
+  u32 base, u32 levels,
+  VkImageLayout   from,
+  VkImageLayout   to
+) {
+  // Coarse but always correct, transfers are not on the hot path yet
+  VkImageMemoryBarrier barrier {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+    .oldLayout = from,
+    .newLayout = to,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = image,
+    .subresourceRange = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .baseMipLevel = base,
+      .levelCount = levels,
+      .baseArrayLayer = 0,
+      .layerCount = 1,
+    },
+  };
+  vkCmdPipelineBarrier(cmd,
+    VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+    0, 0, nullptr, 0, nullptr, 1, &barrier
+  );
+}
+
+
+
+Fence::Fence(const Device& device, bool signaled): device(&device) {
+  VkFenceCreateInfo info {
+    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    .flags = signaled ? VK_FENCE_CREATE_SIGNALED_BIT : 0u,
+  };
+  Error::check(vkCreateFence(device.handle, &info, nullptr, &handle));
+}
+Fence::~Fence() {
+  if(handle != VK_NULL_HANDLE) {
+    vkDestroyFence(device->handle, handle, nullptr);
+  }
+}
+Fence::Fence(Fence&& other) {
+  handle = std::exchange(other.handle, VK_NULL_HANDLE);
+  device = other.device;
+}
+void Fence::wait() const {
+  Error::check(vkWaitForFences(device->handle, 1, &handle, VK_TRUE, UINT64_MAX));
+}
+void Fence::reset() const {
+  Error::check(vkResetFences(device->handle, 1, &handle));
+}
+
+
+
+Semaphore::Semaphore(const Device& device): device(&device) {
+  VkSemaphoreCreateInfo info {
+    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+  };
+  Error::check(vkCreateSemaphore(device.handle, &info, nullptr, &handle));
+}
+Semaphore::~Semaphore() {
+  if(handle != VK_NULL_HANDLE) {
+    vkDestroySemaphore(device->handle, handle, nullptr);
+  }
+}
+Semaphore::Semaphore(Semaphore&& other) {
+  handle = std::exchange(other.handle, VK_NULL_HANDLE);
+  device = other.device;
+}
+
+
+
+CommandPool::CommandPool(const Device& device, QueueFamily::Index family)
+: device(&device) {
+  VkCommandPoolCreateInfo info {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    .queueFamilyIndex = family,
+  };
+  Error::check(vkCreateCommandPool(device.handle, &info, nullptr, &handle));
+}
+CommandPool::~CommandPool() {
+  if(handle != VK_NULL_HANDLE) {
+    vkDestroyCommandPool(device->handle, handle, nullptr);
+  }
+}
+CommandPool::CommandPool(CommandPool&& other) {
+  handle = std::exchange(other.handle, VK_NULL_HANDLE);
+  device = other.device;
+}
+VkCommandBuffer CommandPool::allocate() const {
+  VkCommandBufferAllocateInfo info {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = handle,
+    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    .commandBufferCount = 1,
+  };
+  VkCommandBuffer cmd;
+  Error::check(vkAllocateCommandBuffers(device->handle, &info, &cmd));
+  return cmd;
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include "common.hpp"
+
+struct Buffer {
+  using Handle = VkBuffer;
+  Handle handle = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+
+  // Host visible buffers stay mapped for their whole lifetime
+  void* mapped = nullptr;
+  const Device* device = nullptr;
+
+  Buffer() = default;
+  Buffer(
+    const Device&         device,
+    VkDeviceSize          size,
+    VkBufferUsageFlags    usage,
+    VkMemoryPropertyFlags flags,
+    MemoryCategory        category = MemoryCategory::Buffer
+  );
+  ~Buffer();
+
+  // Move only - cannot be copied
+  Buffer(Buffer&& other);
+  Buffer& operator=(Buffer&& other);
+};
+
+struct Image {
+  using Handle = VkImage;
+
+  struct Config {
+    VkFormat format;
+    VkExtent2D size;
+    u32 levels = 1;
+    VkImageUsageFlags usage;
+    MemoryCategory category = MemoryCategory::Texture;
+  };
+
+  Handle handle = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+
+  Config config;
+  VkDeviceSize bytes = 0;
+  const Device* device = nullptr;
+
+  Image() = default;
+  Image(const Device& device, Config config);
+  ~Image();
+
+  Image(Image&& other);
+  Image& operator=(Image&& other);
+
+  static VkExtent2D level_size(VkExtent2D size, u32 level) {
+    return {
+      .width  = std::max(size.width  >> level, 1u),
+      .height = std::max(size.height >> level, 1u),
+    };
+  }
+  static u32 level_count(VkExtent2D size) {
+    u32 levels = 1;
+    while((std::max(size.width, size.height) >> levels) > 0) levels++;
+    return levels;
+  }
+};
+
+/// Records a layout transition of `levels` mips starting at `base`
+void image_barrier(
+  VkCommandBuffer cmd,
+  VkImage         image,
+  u32 base, u32 levels,
+  VkImageLayout   from,
+  VkImageLayout   to
+);
+
+struct Fence {
+  using Handle = VkFence;
+  Handle handle = VK_NULL_HANDLE;
+  const Device* device = nullptr;
+
+  Fence(const Device& device, bool signaled);
+  ~Fence();
+
+  Fence(Fence&& other);
+  Fence& operator=(Fence&& other) = delete;
+
+  void wait() const;
+  void reset() const;
+};
+
+struct Semaphore {
+  using Handle = VkSemaphore;
+  Handle handle = VK_NULL_HANDLE;
+  const Device* device = nullptr;
+
+  Semaphore(const Device& device);
+  ~Semaphore();
+
+  Semaphore(Semaphore&& other);
+  Semaphore& operator=(Semaphore&& other) = delete;
+};
+
+struct CommandPool {
+  using Handle = VkCommandPool;
+  Handle handle = VK_NULL_HANDLE;
+  const Device* device = nullptr;
+
+  CommandPool(const Device& device, QueueFamily::Index family);
+  ~CommandPool();
+
+  CommandPool(CommandPool&& other);
+  CommandPool& operator=(CommandPool&& other) = delete;
+
+  VkCommandBuffer allocate() const;
+};
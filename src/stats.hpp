@@ -0,0 +1,69 @@
+#pragma once
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <iostream>
+#include <type_traits>
+
+#include "types.hpp"
+
+struct Stopwatch {
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point start = Clock::now();
+
+  f64 elapsed_ms() const {
+    return std::chrono::duration<f64, std::milli>(Clock::now() - start).count();
+  }
+  void restart() {
+    start = Clock::now();
+  }
+};
+
+/// Named per-frame metrics, subsystems write into it and the frame loop reports it.
+/// Safe to write from several threads
+struct Stats {
+  std::map<std::string, f64> values;
+  mutable std::mutex mutex;
+
+  void set(const std::string& name, f64 value) {
+    std::lock_guard lock { mutex };
+    values[name] = value;
+  }
+  void add(const std::string& name, f64 value) {
+    std::lock_guard lock { mutex };
+    values[name] += value;
+  }
+  f64 get(const std::string& name) const {
+    std::lock_guard lock { mutex };
+    auto it = values.find(name);
+    return it != values.end() ? it->second : 0.0;
+  }
+  void clear() {
+    std::lock_guard lock { mutex };
+    values.clear();
+  }
+
+  friend std::ostream& operator<<(std::ostream& out, const Stats& stats) {
+    std::lock_guard lock { stats.mutex };
+    for(const auto& [name, value] : stats.values) {
+      out << "  " << name << " = " << value << std::endl;
+    }
+    return out;
+  }
+};
+
+/// Runs `fn` and records how long it took under `name`
+template<typename Fn>
+auto timed(Stats& stats, const std::string& name, Fn fn) {
+  Stopwatch watch;
+  if constexpr (std::is_void_v<std::invoke_result_t<Fn>>) {
+    fn();
+    stats.set(name, watch.elapsed_ms());
+  }
+  else {
+    auto out = fn();
+    stats.set(name, watch.elapsed_ms());
+    return out;
+  }
+}
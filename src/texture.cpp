@@ -0,0 +1,446 @@
+#include "texture.hpp"
+#include <cstring>
+#include <stdexcept>
+
+
+
+TextureStreamer::TextureStreamer(const Device& device, Queue queue, Config config)
+: m_device(device), m_queue(queue), m_config(config),
+  m_pool(device, queue.family), m_cmd(m_pool.allocate()),
+  m_fence(device, true)
+{
+  m_host_copy = device.has_extension(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+
+  if(m_host_copy) {
+    m_copy_memory_to_image = device.proc<PFN_vkCopyMemoryToImageEXT>(
+      "vkCopyMemoryToImageEXT"
+    );
+    m_transition_image_layout = device.proc<PFN_vkTransitionImageLayoutEXT>(
+      "vkTransitionImageLayoutEXT"
+    );
+
+    // Rest in a layout that can be both sampled and host written if there is one
+    VkPhysicalDeviceHostImageCopyPropertiesEXT host_props {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT,
+    };
+    VkPhysicalDeviceProperties2 props {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &host_props,
+    };
+    vkGetPhysicalDeviceProperties2(device.physical.handle, &props);
+
+    std::vector<VkImageLayout> layouts(host_props.copyDstLayoutCount);
+    host_props.pCopyDstLayouts = layouts.data();
+    vkGetPhysicalDeviceProperties2(device.physical.handle, &props);
+
+    for(auto layout : layouts) {
+      if(layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+        m_host_layout = layout;
+      }
+    }
+  }
+
+  std::cout
+    << "Texture uploads : "
+    << (m_host_copy ? "host image copy" : "staging buffer")
+    << std::endl;
+
+  m_device.budget->add_evictable(this);
+}
+TextureStreamer::~TextureStreamer() {
+  m_fence.wait();
+  m_device.budget->remove_evictable(this);
+}
+
+TextureStreamer::Id TextureStreamer::create(TextureSource source) {
+  u32 levels = Image::level_count(source.size);
+  if(source.levels != 0) levels = std::min(levels, source.levels);
+
+  if(!(source.provided & 1u)) {
+    throw std::runtime_error("Texture level 0 must be provided");
+  }
+
+  u32 all_levels = levels < 32 ? (1u << levels) - 1 : ~0u;
+  auto features = PhysicalDevice { m_device.physical }
+    .format_properties(source.format).optimalTilingFeatures;
+  VkFormatFeatureFlags blit
+    = VK_FORMAT_FEATURE_BLIT_SRC_BIT
+    | VK_FORMAT_FEATURE_BLIT_DST_BIT
+    | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+  if((source.provided & all_levels) != all_levels && (features & blit) != blit) {
+    throw std::runtime_error("Texture format cannot be blitted, provide every level");
+  }
+
+  bool host_copy = false;
+  if(m_host_copy && source.host_copy) {
+    VkFormatProperties3 props3 {
+      .sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3
+    };
+    VkFormatProperties2 props {
+      .sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2,
+      .pNext = &props3,
+    };
+    vkGetPhysicalDeviceFormatProperties2(m_device.physical.handle, source.format, &props);
+    host_copy = props3.optimalTilingFeatures & VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT;
+  }
+
+  m_textures.push_back(Texture {
+    .source = std::move(source),
+    .levels = levels,
+    .image_base = levels,
+    .layout = host_copy ? m_host_layout : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    .host_copy = host_copy,
+  });
+  return static_cast<Id>(m_textures.size() - 1);
+}
+
+void TextureStreamer::touch(Id id, u64 frame) {
+  auto& texture = m_textures[id];
+  texture.last_used = frame;
+  texture.wanted = 0;
+}
+
+
+
+Texture* TextureStreamer::least_recently_used(
+  Option<u32> heap,
+  u64         frame,
+  bool        demoting
+) const {
+  Texture* victim = nullptr;
+  for(auto& texture : m_textures) {
+    // Rendering of the last `frames_in_flight` frames may still sample it
+    if(!texture.image || texture.busy) continue;
+    if(texture.last_used + m_config.frames_in_flight >= frame) continue;
+
+    // Demoting keeps the coarsest level so every texture can be drawn,
+    // dropping must not free an image the open command buffer refers to
+    if(demoting && texture.image_base + 1 >= texture.levels) continue;
+    if(!demoting && texture.recorded) continue;
+    if(heap && m_device.budget->heap_of(texture.image->memory) != heap) continue;
+
+    if(!victim || texture.last_used < victim->last_used) {
+      victim = const_cast<Texture*>(&texture);
+    }
+  }
+  return victim;
+}
+
+void TextureStreamer::demote(Texture& texture) {
+  texture.wanted = texture.image_base + 1;
+  reallocate(texture, texture.wanted);
+  m_counters.evicted++;
+}
+
+void TextureStreamer::drop(Texture& texture) {
+  // No frame in flight samples it, only our own copies can still read it
+  m_fence.wait();
+
+  m_resident_bytes -= texture.image->bytes;
+  texture.image.reset();
+  texture.image_base = texture.levels;
+  texture.wanted = texture.levels;
+  texture.valid = 0;
+  m_counters.evicted++;
+}
+
+Option<u64> TextureStreamer::oldest_use(u32 heap, u64 frame) const {
+  auto victim = least_recently_used(heap, frame, false);
+  if(!victim) return {};
+  return victim->last_used;
+}
+
+void TextureStreamer::evict_oldest(u32 heap, u64 frame) {
+  // The budget needs memory back now, demoting would allocate a smaller
+  // image first and only free the old one after the next fence
+  auto victim = least_recently_used(heap, frame, false);
+  if(victim) drop(*victim);
+}
+
+bool TextureStreamer::ensure_budget(VkDeviceSize needed, u64 frame) {
+  while(m_resident_bytes + needed > m_config.residency_budget) {
+    auto victim = least_recently_used({}, frame, true);
+    if(!victim) return false;
+    demote(*victim);
+  }
+  return true;
+}
+
+void TextureStreamer::reallocate(Texture& texture, u32 base) {
+  VkImageUsageFlags usage
+    = VK_IMAGE_USAGE_SAMPLED_BIT
+    | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+    | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  if(texture.host_copy) usage |= VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+
+  // Allocating may evict other textures through the memory budget
+  texture.busy = true;
+
+  u32 levels = texture.levels - base;
+  Image image { m_device, {
+    .format = texture.source.format,
+    .size = Image::level_size(texture.source.size, base),
+    .levels = levels,
+    .usage = usage,
+  }};
+
+  if(texture.host_copy) {
+    VkHostImageLayoutTransitionInfoEXT transition {
+      .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT,
+      .image = image.handle,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = texture.layout,
+      .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1 },
+    };
+    Error::check(m_transition_image_layout(m_device.handle, 1, &transition));
+  }
+  else {
+    image_barrier(m_cmd, image.handle, 0, levels,
+      VK_IMAGE_LAYOUT_UNDEFINED, texture.layout
+    );
+  }
+
+  // Carry over every valid level both images have in common
+  u32 valid = texture.valid & ~((1u << base) - 1);
+  if(texture.image) {
+    auto& old = *texture.image;
+    image_barrier(m_cmd, old.handle, 0, old.config.levels,
+      texture.layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+    );
+    image_barrier(m_cmd, image.handle, 0, levels,
+      texture.layout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+    );
+
+    for(u32 level = std::max(base, texture.image_base); level < texture.levels; level++) {
+      if(!(valid & (1u << level))) continue;
+
+      auto size = Image::level_size(texture.source.size, level);
+      VkImageCopy region {
+        .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - texture.image_base, 0, 1 },
+        .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - base, 0, 1 },
+        .extent = { size.width, size.height, 1 },
+      };
+      vkCmdCopyImage(m_cmd,
+        old.handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        image.handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1, &region
+      );
+    }
+
+    image_barrier(m_cmd, image.handle, 0, levels,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture.layout
+    );
+
+    m_resident_bytes -= old.bytes;
+    m_retired.push_back(Retired { .image = std::move(old), .frame = m_frame });
+  }
+
+  m_resident_bytes += image.bytes;
+  texture.image = std::move(image);
+  texture.image_base = base;
+  texture.valid = valid;
+  texture.busy = false;
+  texture.recorded = true;
+}
+
+void TextureStreamer::upload(Texture& texture, u32 level) {
+  auto data = texture.source.load(level);
+  auto size = Image::level_size(texture.source.size, level);
+  u32 mip = level - texture.image_base;
+
+  if(texture.host_copy) {
+    VkMemoryToImageCopyEXT region {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT,
+      .pHostPointer = data.data(),
+      .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 },
+      .imageExtent = { size.width, size.height, 1 },
+    };
+    VkCopyMemoryToImageInfoEXT info {
+      .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT,
+      .dstImage = texture.image->handle,
+      .dstImageLayout = texture.layout,
+      .regionCount = 1,
+      .pRegions = &region,
+    };
+    Error::check(m_copy_memory_to_image(m_device.handle, &info));
+  }
+  else {
+    std::memcpy(
+      static_cast<u8*>(m_staging.mapped) + m_staging_offset,
+      data.data(), data.size()
+    );
+
+    image_barrier(m_cmd, texture.image->handle, mip, 1,
+      texture.layout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+    );
+    VkBufferImageCopy region {
+      .bufferOffset = m_staging_offset,
+      .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 },
+      .imageExtent = { size.width, size.height, 1 },
+    };
+    vkCmdCopyBufferToImage(m_cmd,
+      m_staging.handle, texture.image->handle,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region
+    );
+    image_barrier(m_cmd, texture.image->handle, mip, 1,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture.layout
+    );
+
+    // Keep offsets aligned for any texel size
+    m_staging_offset += (data.size() + 15) & ~VkDeviceSize { 15 };
+  }
+
+  texture.valid |= 1u << level;
+  texture.recorded = true;
+  m_counters.bytes += data.size();
+  m_counters.uploaded++;
+}
+
+void TextureStreamer::generate(Texture& texture, u32 level) {
+  auto src_size = Image::level_size(texture.source.size, level - 1);
+  auto dst_size = Image::level_size(texture.source.size, level);
+  u32 mip = level - texture.image_base;
+  auto image = texture.image->handle;
+
+  image_barrier(m_cmd, image, mip - 1, 1,
+    texture.layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+  );
+  image_barrier(m_cmd, image, mip, 1,
+    texture.layout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+  );
+
+  VkImageBlit region {
+    .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip - 1, 0, 1 },
+    .srcOffsets = { { 0, 0, 0 }, { i32(src_size.width), i32(src_size.height), 1 } },
+    .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 },
+    .dstOffsets = { { 0, 0, 0 }, { i32(dst_size.width), i32(dst_size.height), 1 } },
+  };
+  vkCmdBlitImage(m_cmd,
+    image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+    image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    1, &region, VK_FILTER_LINEAR
+  );
+
+  image_barrier(m_cmd, image, mip - 1, 1,
+    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture.layout
+  );
+  image_barrier(m_cmd, image, mip, 1,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture.layout
+  );
+
+  texture.valid |= 1u << level;
+  texture.recorded = true;
+  m_counters.generated++;
+}
+
+Option<TextureStreamer::Id> TextureStreamer::next_upload(
+  const std::vector<bool>& blocked, u32& level
+) const {
+  // Coarsest pending level across all textures first so everything gets
+  // something to draw, ties go to the most recently used texture
+  Option<Id> best;
+  for(Id id = 0; id < m_textures.size(); id++) {
+    const auto& texture = m_textures[id];
+    if(blocked[id]) continue;
+
+    for(u32 l = texture.levels; l-- > texture.wanted;) {
+      if(!texture.is_provided(l) || texture.is_valid(l)) continue;
+
+      if(!best || l > level
+      || (l == level && texture.last_used > m_textures[*best].last_used)) {
+        best = id;
+        level = l;
+      }
+      break;
+    }
+  }
+  return best;
+}
+
+void TextureStreamer::update(u64 frame, Stats& stats) {
+  m_fence.wait();
+  m_frame = frame;
+  m_staging_offset = 0;
+
+  // Frames up to the one an image was replaced in may still sample it
+  while(!m_retired.empty()
+  && m_retired.front().frame + m_config.frames_in_flight <= frame) {
+    m_retired.pop_front();
+  }
+  m_counters = {};
+
+  Stopwatch watch;
+
+  VkCommandBufferBeginInfo begin {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  Error::check(vkResetCommandBuffer(m_cmd, 0));
+  Error::check(vkBeginCommandBuffer(m_cmd, &begin));
+
+  std::vector<bool> blocked(m_textures.size(), false);
+  u32 level = 0;
+  while(auto id = next_upload(blocked, level)) {
+    auto& texture = m_textures[*id];
+    auto bytes = texture.level_bytes(level);
+
+    if(m_counters.uploaded > 0
+    && m_counters.bytes + bytes > m_config.upload_budget) break;
+
+    // Staging memory is only reused after the fence, grow it on an empty frame
+    if(!texture.host_copy && m_staging_offset + bytes > m_staging.size) {
+      if(m_staging_offset > 0) break;
+
+      m_staging = Buffer {};
+      m_staging = Buffer { m_device,
+        std::max(bytes, m_config.upload_budget),
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        MemoryCategory::Staging
+      };
+    }
+
+    // The image only reaches down to the finest level uploaded so far and
+    // grows as finer levels arrive, the budget sees what is really resident
+    if(texture.image_base > level) {
+      VkDeviceSize estimate = 0;
+      for(u32 l = level; l < texture.levels; l++) {
+        estimate += texture.level_bytes(l);
+      }
+      if(texture.image) estimate -= std::min(estimate, texture.image->bytes);
+
+      texture.busy = true;
+      if(!ensure_budget(estimate, frame)) {
+        texture.busy = false;
+        blocked[*id] = true;
+        continue;
+      }
+      reallocate(texture, level);
+    }
+
+    upload(texture, level);
+    for(u32 l = level + 1; l < texture.levels; l++) {
+      if(texture.is_provided(l) || texture.is_valid(l)) break;
+      generate(texture, l);
+    }
+  }
+
+  Error::check(vkEndCommandBuffer(m_cmd));
+  for(auto& texture : m_textures) texture.recorded = false;
+
+  m_fence.reset();
+  VkSubmitInfo submit {
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &m_cmd,
+  };
+  Error::check(vkQueueSubmit(m_queue.handle, 1, &submit, m_fence.handle));
+
+  stats.set("texture.upload_bytes",     static_cast<f64>(m_counters.bytes));
+  stats.set("texture.upload_ms",        watch.elapsed_ms());
+  stats.set("texture.levels_uploaded",  m_counters.uploaded);
+  stats.set("texture.levels_generated", m_counters.generated);
+  stats.set("texture.levels_evicted",   m_counters.evicted);
+  stats.set("texture.resident_bytes",   static_cast<f64>(m_resident_bytes));
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <deque>
+#include <span>
+#include <vector>
+
+#include "common.hpp"
+#include "memory.hpp"
+#include "resource.hpp"
+#include "stats.hpp"
+
+struct TextureSource {
+  VkFormat format;
+  VkExtent2D size;
+
+  /// Length of the mip chain, 0 for the full chain down to 1x1
+  u32 levels = 0;
+  /// Bytes per texel, only uncompressed formats are streamed
+  u32 texel_bytes;
+
+  /// Bitmask of levels `load` can supply, the rest are generated on the GPU.
+  /// Level 0 must always be provided
+  u32 provided = 1;
+  /// Tightly packed texels of a provided level
+  std::function<std::span<const u8>(u32 level)> load;
+
+  /// Off forces the staging buffer even where host image copy is available
+  bool host_copy = true;
+};
+
+struct Texture {
+  TextureSource source;
+  u32 levels;
+
+  // Mip `i` of `image` holds texture level `image_base + i`
+  Option<Image> image;
+  u32 image_base;
+  VkImageLayout layout;
+  bool host_copy;
+
+  u32 valid = 0;
+  u32 wanted = 0;
+  u64 last_used = 0;
+
+  // Being reallocated, must not be picked for eviction
+  bool busy = false;
+  // Referenced by the update being recorded, must not be dropped before it is submitted
+  bool recorded = false;
+
+  bool is_valid(u32 level) const {
+    return valid & (1u << level);
+  }
+  bool is_provided(u32 level) const {
+    return source.provided & (1u << level);
+  }
+
+  /// Finest level such that it and every coarser level can be sampled
+  u32 resident() const {
+    u32 level = levels;
+    while(level > 0 && is_valid(level - 1)) level--;
+    return level;
+  }
+  /// Sampler min LOD that keeps reads within resident levels
+  f32 min_lod() const {
+    return static_cast<f32>(resident() - image_base);
+  }
+
+  VkDeviceSize level_bytes(u32 level) const {
+    auto size = Image::level_size(source.size, level);
+    return VkDeviceSize { size.width } * size.height * source.texel_bytes;
+  }
+};
+
+/// Streams textures coarsest level first under a residency budget.
+///
+/// Uses VK_EXT_host_image_copy to write straight into optimal images when
+/// the device has it enabled, otherwise goes through a staging buffer.
+///
+/// Over the residency budget the least recently used texture loses its
+/// finest level. Registered with the device memory budget too, under
+/// pressure there the least recently used texture drops its whole image.
+/// Textures used by a frame still in flight are never picked
+class TextureStreamer : public Evictable {
+public:
+  using Id = u32;
+
+  struct Config {
+    /// Device memory all texture images may occupy together
+    VkDeviceSize residency_budget = VkDeviceSize { 256 } << 20;
+    /// Texel bytes uploaded per frame, at least one level always goes through
+    VkDeviceSize upload_budget = VkDeviceSize { 16 } << 20;
+    /// Frames of rendering that may still be on the GPU when `update` runs,
+    /// images they sampled are not freed before those frames are done
+    u32 frames_in_flight = 2;
+  };
+
+  TextureStreamer(const Device& device, Queue queue, Config config);
+  ~TextureStreamer();
+
+  TextureStreamer(TextureStreamer&&) = delete;
+
+  Id create(TextureSource source);
+  const Texture& get(Id id) const {
+    return m_textures[id];
+  }
+
+  /// Marks a texture as used this frame, it will stream back to full resolution
+  void touch(Id id, u64 frame);
+
+  /// Uploads pending levels, generates missing ones and evicts to stay in budget
+  void update(u64 frame, Stats& stats);
+
+  bool host_copy() const {
+    return m_host_copy;
+  }
+
+  Option<u64> oldest_use(u32 heap, u64 frame) const override;
+  void evict_oldest(u32 heap, u64 frame) override;
+
+private:
+  const Device& m_device;
+  Queue m_queue;
+  Config m_config;
+
+  CommandPool m_pool;
+  VkCommandBuffer m_cmd;
+  Fence m_fence;
+
+  Buffer m_staging;
+  VkDeviceSize m_staging_offset = 0;
+
+  // Replaced images, destroyed once no frame in flight can sample them
+  struct Retired {
+    Image image;
+    u64 frame;
+  };
+  std::deque<Retired> m_retired;
+  u64 m_frame = 0;
+
+  std::vector<Texture> m_textures;
+  VkDeviceSize m_resident_bytes = 0;
+
+  bool m_host_copy = false;
+  VkImageLayout m_host_layout = VK_IMAGE_LAYOUT_GENERAL;
+  PFN_vkCopyMemoryToImageEXT m_copy_memory_to_image = nullptr;
+  PFN_vkTransitionImageLayoutEXT m_transition_image_layout = nullptr;
+
+  struct FrameCounters {
+    VkDeviceSize bytes = 0;
+    u32 uploaded = 0;
+    u32 generated = 0;
+    u32 evicted = 0;
+  };
+  FrameCounters m_counters;
+
+  Texture* least_recently_used(Option<u32> heap, u64 frame, bool demoting) const;
+  void demote(Texture& texture);
+  void drop(Texture& texture);
+
+  bool ensure_budget(VkDeviceSize needed, u64 frame);
+  void reallocate(Texture& texture, u32 base);
+  void upload(Texture& texture, u32 level);
+  void generate(Texture& texture, u32 level);
+  Option<Id> next_upload(const std::vector<bool>& blocked, u32& level) const;
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+
+class ThreadPool {
+  std::vector<std::thread> m_workers;
+  std::deque<std::function<void()>> m_tasks;
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  bool m_stop = false;
+
+  void work() {
+    while(true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lock { m_mutex };
+        m_wake.wait(lock, [this]{ return m_stop || !m_tasks.empty(); });
+        if(m_stop && m_tasks.empty()) return;
+
+        task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+      }
+      task();
+    }
+  }
+public:
+  explicit ThreadPool(u32 threads = std::max(std::thread::hardware_concurrency(), 2u)) {
+    for(u32 i = 0; i < threads; i++) {
+      m_workers.emplace_back([this]{ work(); });
+    }
+  }
+  /// Finishes every queued task before joining
+  ~ThreadPool() {
+    {
+      std::lock_guard lock { m_mutex };
+      m_stop = true;
+    }
+    m_wake.notify_all();
+    for(auto& worker : m_workers) worker.join();
+  }
+
+  ThreadPool(ThreadPool&&) = delete;
+
+  u32 size() const {
+    return static_cast<u32>(m_workers.size());
+  }
+
+  /// Exceptions thrown by `fn` are rethrown from the returned future
+  template<typename Fn>
+  auto submit(Fn fn) -> std::future<std::invoke_result_t<Fn>> {
+    using T = std::invoke_result_t<Fn>;
+
+    // std::function needs a copyable target, packaged_task is move only
+    auto task = std::make_shared<std::packaged_task<T()>>(std::move(fn));
+    auto future = task->get_future();
+    {
+      std::lock_guard lock { m_mutex };
+      m_tasks.emplace_back([task]{ (*task)(); });
+    }
+    m_wake.notify_one();
+    return future;
+  }
+};